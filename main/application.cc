@@ -11,6 +11,7 @@
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "audio_debugger.h"
+#include "settings.h"
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "afe_audio_processor.h"
@@ -27,6 +28,8 @@
 #endif
 
 #include <cstring>
+#include <cctype>
+#include <sys/time.h>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -61,6 +64,12 @@ Application::Application() {
     aec_mode_ = kAecOff;
 #endif
 
+#if CONFIG_USE_SHARED_AFE
+    // One AFE_TYPE_SR front-end runs AEC/NS once and feeds both WakeNet and the VAD/encoder path
+    auto afe_frontend = std::make_shared<AfeFrontend>(AFE_TYPE_SR);
+    audio_processor_ = std::make_unique<AfeAudioProcessor>(afe_frontend);
+    wake_word_ = std::make_unique<AfeWakeWord>(afe_frontend);
+#else
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
@@ -73,6 +82,7 @@ Application::Application() {
     wake_word_ = std::make_unique<EspWakeWord>();
 #else
     wake_word_ = std::make_unique<NoWakeWord>();
+#endif
 #endif
 
     esp_timer_create_args_t clock_timer_args = {
@@ -382,16 +392,25 @@ void Application::Start() {
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    int frame_duration = OPUS_FRAME_DURATION_MS;
+    {
+        Settings settings("audio", false);
+        frame_duration = settings.GetInt("frame_duration", frame_duration);
+    }
+    if (frame_duration != 20 && frame_duration != 40 && frame_duration != 60) {
+        ESP_LOGW(TAG, "Invalid frame duration %d in settings, using %d ms", frame_duration, OPUS_FRAME_DURATION_MS);
+        frame_duration = OPUS_FRAME_DURATION_MS;
+    }
+    uplink_encoder_ = std::make_unique<UplinkEncoder>(16000, 1, frame_duration);
     if (aec_mode_ != kAecOff) {
         ESP_LOGI(TAG, "AEC mode: %d, setting opus encoder complexity to 0", aec_mode_);
-        opus_encoder_->SetComplexity(0);
+        uplink_encoder_->SetComplexity(0);
     } else if (board.GetBoardType() == "ml307") {
         ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
+        uplink_encoder_->SetComplexity(5);
     } else {
         ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 0");
-        opus_encoder_->SetComplexity(0);
+        uplink_encoder_->SetComplexity(0);
     }
 
     if (codec->input_sample_rate() != 16000) {
@@ -399,6 +418,22 @@ void Application::Start() {
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
     codec->Start();
+    codec->OnOutputVolumeChanged([display](int volume) {
+        display->UpdateStatusBar(kStatusBarMute);
+        McpServer::GetInstance().NotifyStateChanged();
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+        iot::ThingManager::GetInstance().NotifyPropertyChanged("AudioSpeaker", "volume");
+#endif
+    });
+    auto backlight = board.GetBacklight();
+    if (backlight) {
+        backlight->OnBrightnessChanged([](uint8_t brightness) {
+            McpServer::GetInstance().NotifyStateChanged();
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+            iot::ThingManager::GetInstance().NotifyPropertyChanged("Screen", "brightness");
+#endif
+        });
+    }
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     xTaskCreatePinnedToCore([](void* arg) {
@@ -415,13 +450,13 @@ void Application::Start() {
 #endif
 
     /* Start the clock timer to update the status bar */
-    esp_timer_start_periodic(clock_timer_handle_, 1000000);
+    StartClockTimer(CLOCK_TICK_MS);
 
     /* Wait for the network to be ready */
     board.StartNetwork();
 
     // Update the status bar immediately to show the network state
-    display->UpdateStatusBar(true);
+    display->UpdateStatusBar(kStatusBarAll);
 
     // Check for new firmware version or get the MQTT broker address
     CheckNewVersion(); 
@@ -442,6 +477,7 @@ void Application::Start() {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+    protocol_->SetPreferredFrameDuration(uplink_encoder_->duration_ms());
 
     protocol_->OnNetworkError([this](const std::string& message) {
         SetDeviceState(kDeviceStateIdle);
@@ -449,7 +485,7 @@ void Application::Start() {
     });
     protocol_->OnIncomingAudio([this](AudioStreamPacket&& packet) {
         std::lock_guard<std::mutex> lock(mutex_);
-        if (device_state_ == kDeviceStateSpeaking && audio_decode_queue_.size() < MAX_AUDIO_PACKETS_IN_QUEUE) {
+        if (device_state_ == kDeviceStateSpeaking && audio_decode_queue_.size() < MAX_AUDIO_PACKETS_IN_QUEUE(protocol_->server_frame_duration())) {
             audio_decode_queue_.emplace_back(std::move(packet));
         }
     });
@@ -459,10 +495,12 @@ void Application::Start() {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
+        // The audio processor is stopped until listening starts, so the encoder can be resized here
+        uplink_encoder_->SetDuration(protocol_->frame_duration());
 
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
         auto& thing_manager = iot::ThingManager::GetInstance();
-        protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
+        protocol_->SendIotDescriptors(thing_manager.GetDescriptors());
         std::string states;
         if (thing_manager.GetStatesJson(states, false)) {
             protocol_->SendIotStates(states);
@@ -485,6 +523,7 @@ void Application::Start() {
             if (strcmp(state->valuestring, "start") == 0) {
                 Schedule([this]() {
                     aborted_ = false;
+                    new_assistant_message_ = true;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
@@ -505,7 +544,15 @@ void Application::Start() {
                 if (cJSON_IsString(text)) {
                     ESP_LOGI(TAG, "<< %s", text->valuestring);
                     Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
+                        // Sentences of one answer extend the same message
+                        if (new_assistant_message_) {
+                            display->SetChatMessage("assistant", message.c_str());
+                            new_assistant_message_ = false;
+                        } else if (isalnum((unsigned char)message[0])) {
+                            display->AppendChatMessage("assistant", (" " + message).c_str());
+                        } else {
+                            display->AppendChatMessage("assistant", message.c_str());
+                        }
                         // 转发到电脑屏幕显示
                         forward_chat_message("moss", message.c_str(), "text");
                     });
@@ -516,6 +563,7 @@ void Application::Start() {
             if (cJSON_IsString(text)) {
                 ESP_LOGI(TAG, ">> %s", text->valuestring);
                 Schedule([this, display, message = std::string(text->valuestring)]() {
+                    new_assistant_message_ = true;
                     display->SetChatMessage("user", message.c_str());
                     // 转发到电脑屏幕显示
                     forward_chat_message("user", message.c_str(), "text");
@@ -531,7 +579,7 @@ void Application::Start() {
 #if CONFIG_IOT_PROTOCOL_MCP
         } else if (strcmp(type->valuestring, "mcp") == 0) {
             auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
+            if (cJSON_IsObject(payload) || cJSON_IsArray(payload)) {
                 McpServer::GetInstance().ParseMessage(payload);
             }
 #endif
@@ -576,45 +624,58 @@ void Application::Start() {
 
     audio_debugger_ = std::make_unique<AudioDebugger>();
     audio_processor_->Initialize(codec);
-    audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
+    audio_processor_->OnOutput([this](const int16_t* data, size_t samples) {
+        uplink_encoder_->Write(data, samples);
+    });
+    uplink_encoder_->OnEncoded([this](const uint8_t* opus, size_t size) {
+        // Reuse a packet node from the pool, its payload keeps the capacity of earlier frames
+        std::list<AudioStreamPacket> packets;
         {
             std::lock_guard<std::mutex> lock(mutex_);
-            if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                ESP_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
-                return;
+            if (audio_packet_pool_.empty()) {
+                packets.emplace_back();
+            } else {
+                packets.splice(packets.end(), audio_packet_pool_, audio_packet_pool_.begin());
             }
         }
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                AudioStreamPacket packet;
-                packet.payload = std::move(opus);
+        auto& packet = packets.back();
+        packet.payload.assign(opus, opus + size);
+        packet.timestamp = 0;
 #ifdef CONFIG_USE_SERVER_AEC
-                {
-                    std::lock_guard<std::mutex> lock(timestamp_mutex_);
-                    if (!timestamp_queue_.empty()) {
-                        packet.timestamp = timestamp_queue_.front();
-                        timestamp_queue_.pop_front();
-                    } else {
-                        packet.timestamp = 0;
-                    }
+        {
+            std::lock_guard<std::mutex> lock(timestamp_mutex_);
+            if (!timestamp_queue_.empty()) {
+                packet.timestamp = timestamp_queue_.front();
+                timestamp_queue_.pop_front();
+            }
 
-                    if (timestamp_queue_.size() > 3) { // 限制队列长度3
-                        timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
-                        return;
-                    }
-                }
-#endif
+            if (timestamp_queue_.size() > 3) { // 限制队列长度3
+                timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
                 std::lock_guard<std::mutex> lock(mutex_);
-                if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                    ESP_LOGW(TAG, "Too many audio packets in queue, drop the oldest packet");
-                    audio_send_queue_.pop_front();
-                }
-                audio_send_queue_.emplace_back(std::move(packet));
-                xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
-            });
-        });
+                audio_packet_pool_.splice(audio_packet_pool_.end(), packets);
+                return;
+            }
+        }
+#endif
+        if (silence_suppression_enabled_) {
+            silence_suppressor_.Process(packets);
+            if (packets.empty()) {
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!packets.empty()) {
+            if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE(uplink_encoder_->duration_ms())) {
+                ESP_LOGW(TAG, "Too many audio packets in queue, drop the oldest packet");
+                audio_packet_pool_.splice(audio_packet_pool_.end(), audio_send_queue_, audio_send_queue_.begin());
+            }
+            audio_send_queue_.splice(audio_send_queue_.end(), packets, packets.begin());
+        }
+        xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
     });
     audio_processor_->OnVadStateChange([this](bool speaking) {
+        silence_suppressor_.OnVadStateChange(speaking);
         if (device_state_ == kDeviceStateListening) {
             Schedule([this, speaking]() {
                 if (speaking) {
@@ -636,7 +697,9 @@ void Application::Start() {
             }
 
             if (device_state_ == kDeviceStateIdle) {
-                wake_word_->EncodeWakeWordData();
+                // Encode the pre-roll while the channel opens, with the duration the hello is likely to keep
+                int preroll_duration = protocol_->frame_duration();
+                wake_word_->EncodeWakeWordData(preroll_duration);
 
                 if (!protocol_->IsAudioChannelOpened()) {
                     SetDeviceState(kDeviceStateConnecting);
@@ -645,6 +708,10 @@ void Application::Start() {
                         return;
                     }
                 }
+                if (protocol_->frame_duration() != preroll_duration) {
+                    ESP_LOGI(TAG, "Frame duration negotiated to %d ms, re-encode the wake word pre-roll", protocol_->frame_duration());
+                    wake_word_->EncodeWakeWordData(protocol_->frame_duration());
+                }
 
                 ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_USE_AFE_WAKE_WORD
@@ -692,29 +759,41 @@ void Application::Start() {
     MainEventLoop();
 }
 
+void Application::StartClockTimer(int delay_ms) {
+    esp_timer_stop(clock_timer_handle_);
+    esp_timer_start_once(clock_timer_handle_, delay_ms * 1000LL);
+}
+
+// Ticks once per minute, on the minute once the server time is known
 void Application::OnClockTimer() {
-    clock_ticks_++;
+    int delay_ms = CLOCK_TICK_MS;
+    if (ota_.HasServerTime()) {
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        delay_ms = (60 - now.tv_sec % 60) * 1000 - now.tv_usec / 1000;
+    }
+    esp_timer_start_once(clock_timer_handle_, delay_ms * 1000LL);
 
+    // Mute and Wi-Fi icons follow their change events, battery gauges are read here
     auto display = Board::GetInstance().GetDisplay();
-    display->UpdateStatusBar();
+    display->UpdateStatusBar(kStatusBarBattery | kStatusBarNetwork);
 
-    // Print the debug info every 10 seconds
-    if (clock_ticks_ % 10 == 0) {
-        // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
-        // SystemInfo::PrintTaskList();
-        SystemInfo::PrintHeapStats();
+    // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
+    // SystemInfo::PrintTaskList();
+    SystemInfo::PrintHeapStats();
+    display->PrintCommandStats();
+    McpServer::GetInstance().PrintToolStats();
 
-        // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
-        if (ota_.HasServerTime()) {
-            if (device_state_ == kDeviceStateIdle) {
-                Schedule([this]() {
-                    // Set status to clock "HH:MM"
-                    time_t now = time(NULL);
-                    char time_str[64];
-                    strftime(time_str, sizeof(time_str), "%H:%M  ", localtime(&now));
-                    Board::GetInstance().GetDisplay()->SetStatus(time_str);
-                });
-            }
+    // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
+    if (ota_.HasServerTime()) {
+        if (device_state_ == kDeviceStateIdle) {
+            Schedule([this]() {
+                // Set status to clock "HH:MM"
+                time_t now = time(NULL);
+                char time_str[64];
+                strftime(time_str, sizeof(time_str), "%H:%M  ", localtime(&now));
+                Board::GetInstance().GetDisplay()->SetStatus(time_str);
+            });
         }
     }
 }
@@ -747,6 +826,13 @@ void Application::MainEventLoop() {
                     break;
                 }
             }
+
+            // Recycle the packets so the encoder does not allocate a new node and payload per frame
+            lock.lock();
+            audio_packet_pool_.splice(audio_packet_pool_.end(), packets);
+            while (audio_packet_pool_.size() > MAX_AUDIO_PACKETS_IN_QUEUE(uplink_encoder_->duration_ms())) {
+                audio_packet_pool_.pop_back();
+            }
         }
 
         if (bits & SCHEDULE_EVENT) {
@@ -849,7 +935,7 @@ void Application::OnAudioInput() {
         }
     }
 
-    vTaskDelay(pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
+    vTaskDelay(pdMS_TO_TICKS(uplink_encoder_->duration_ms() / 2));
 }
 
 bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
@@ -902,9 +988,30 @@ bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+    FlushPlayback();
     protocol_->SendAbortSpeaking(reason);
 }
 
+// Drop the queued packets and cut the I2S DMA ring with a short fade-out.
+// The flush runs on the background task so it never races with a pending OutputData,
+// PLAYBACK_FLUSHED_EVENT is set once the speaker is silent.
+void Application::FlushPlayback() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        audio_decode_queue_.clear();
+    }
+    audio_decode_cv_.notify_all();
+
+    xEventGroupClearBits(event_group_, PLAYBACK_FLUSHED_EVENT);
+    auto start_time = esp_timer_get_time();
+    background_task_->Schedule([this, start_time]() {
+        auto codec = Board::GetInstance().GetAudioCodec();
+        codec->FlushOutput();
+        xEventGroupSetBits(event_group_, PLAYBACK_FLUSHED_EVENT);
+        ESP_LOGI(TAG, "Playback flushed in %ld us", (long)(esp_timer_get_time() - start_time));
+    });
+}
+
 void Application::SetListeningMode(ListeningMode mode) {
     listening_mode_ = mode;
     SetDeviceState(kDeviceStateListening);
@@ -915,7 +1022,6 @@ void Application::SetDeviceState(DeviceState state) {
         return;
     }
     
-    clock_ticks_ = 0;
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
@@ -930,9 +1036,18 @@ void Application::SetDeviceState(DeviceState state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
             display->SetStatus(Lang::Strings::STANDBY);
+            // Show the clock shortly after going idle instead of waiting for the minute
+            StartClockTimer(CLOCK_IDLE_DELAY_MS);
             display->SetEmotion("neutral");
             audio_processor_->Stop();
             wake_word_->StartDetection();
+            uplink_encoder_->PrintStats();
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+            uplink_encoder_->ResetState([this]() {
+                silence_suppression_enabled_ = false;
+                silence_suppressor_.Reset(uplink_encoder_->duration_ms());
+            });
+#endif
             break;
         case kDeviceStateConnecting:
             display->SetStatus(Lang::Strings::CONNECTING);
@@ -953,12 +1068,21 @@ void Application::SetDeviceState(DeviceState state) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
                 if (previous_state == kDeviceStateSpeaking) {
-                    audio_decode_queue_.clear();
-                    audio_decode_cv_.notify_all();
-                    // FIXME: Wait for the speaker to empty the buffer
-                    vTaskDelay(pdMS_TO_TICKS(120));
+                    // Make sure the speaker is silent before the microphone opens.
+                    // After AbortSpeaking the flush is already on its way and no packet is decoded any more.
+                    if (!aborted_) {
+                        FlushPlayback();
+                    }
+                    xEventGroupWaitBits(event_group_, PLAYBACK_FLUSHED_EVENT, pdFALSE, pdFALSE, pdMS_TO_TICKS(200));
                 }
-                opus_encoder_->ResetState();
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+                uplink_encoder_->ResetState([this]() {
+                    silence_suppression_enabled_ = listening_mode_ == kListeningModeRealtime && protocol_->server_dtx();
+                    silence_suppressor_.Reset(uplink_encoder_->duration_ms());
+                });
+#else
+                uplink_encoder_->ResetState();
+#endif
                 audio_processor_->Start();
                 wake_word_->StopDetection();
             }
@@ -1010,6 +1134,10 @@ void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
 
 void Application::UpdateIotStates() {
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
+    // States changed while the channel is closed are sent when listening starts
+    if (!protocol_ || !protocol_->IsAudioChannelOpened()) {
+        return;
+    }
     auto& thing_manager = iot::ThingManager::GetInstance();
     std::string states;
     if (thing_manager.GetStatesJson(states, true)) {
@@ -12,6 +12,7 @@
 #include <vector>
 #include <condition_variable>
 #include <memory>
+#include <atomic>
 
 #include <opus_encoder.h>
 #include <opus_decoder.h>
@@ -23,11 +24,14 @@
 #include "audio_processor.h"
 #include "wake_word.h"
 #include "audio_debugger.h"
+#include "silence_suppressor.h"
+#include "uplink_encoder.h"
 #include "extend/chat_web_server/web_server.h"
 
 #define SCHEDULE_EVENT (1 << 0)
 #define SEND_AUDIO_EVENT (1 << 1)
 #define CHECK_NEW_VERSION_DONE_EVENT (1 << 2)
+#define PLAYBACK_FLUSHED_EVENT (1 << 3)
 
 enum AecMode {
     kAecOff,
@@ -48,8 +52,15 @@ enum DeviceState {
     kDeviceStateFatalError
 };
 
-#define OPUS_FRAME_DURATION_MS 60
-#define MAX_AUDIO_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// Preferred uplink frame duration, the session value is negotiated in hello
+#define OPUS_FRAME_DURATION_MS CONFIG_OPUS_FRAME_DURATION_MS
+// Audio queues hold about 2.4 seconds whatever the frame duration is
+#define MAX_AUDIO_QUEUE_DURATION_MS 2400
+#define MAX_AUDIO_PACKETS_IN_QUEUE(frame_duration) (MAX_AUDIO_QUEUE_DURATION_MS / (frame_duration))
+
+// The clock timer refreshes the status bar once per minute
+#define CLOCK_TICK_MS (60 * 1000)
+#define CLOCK_IDLE_DELAY_MS (10 * 1000)
 
 class Application {
 public:
@@ -102,7 +113,7 @@ private:
     bool aborted_ = false;
     bool voice_detected_ = false;
     bool busy_decoding_audio_ = false;
-    int clock_ticks_ = 0;
+    bool new_assistant_message_ = true;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
     // Audio encode / decode
@@ -110,6 +121,7 @@ private:
     BackgroundTask* background_task_ = nullptr;
     std::chrono::steady_clock::time_point last_output_time_;
     std::list<AudioStreamPacket> audio_send_queue_;
+    std::list<AudioStreamPacket> audio_packet_pool_;
     std::list<AudioStreamPacket> audio_decode_queue_;
     std::condition_variable audio_decode_cv_;
 
@@ -117,9 +129,13 @@ private:
     std::list<uint32_t> timestamp_queue_;
     std::mutex timestamp_mutex_;
 
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    std::unique_ptr<UplinkEncoder> uplink_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
 
+    // Uplink silence suppression, only active in realtime mode when the server accepts dtx
+    SilenceSuppressor silence_suppressor_;
+    std::atomic<bool> silence_suppression_enabled_ = false;
+
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
     OpusResampler output_resampler_;
@@ -129,9 +145,11 @@ private:
     void OnAudioOutput();
     bool ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    void FlushPlayback();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
     void CheckNewVersion();
     void ShowActivationCode();
+    void StartClockTimer(int delay_ms);
     void OnClockTimer();
     void SetListeningMode(ListeningMode mode);
     void AudioLoop();
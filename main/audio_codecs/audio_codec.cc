@@ -15,9 +15,55 @@ AudioCodec::~AudioCodec() {
 }
 
 void AudioCodec::OutputData(std::vector<int16_t>& data) {
+    if (data.empty()) {
+        return;
+    }
+    last_output_sample_ = data.back();
     Write(data.data(), data.size());
 }
 
+// Drop whatever is still queued in the TX DMA ring. Must be called from the same task that calls OutputData,
+// otherwise a blocked i2s_channel_write would fail when the channel is disabled underneath it.
+void AudioCodec::FlushOutput() {
+    if (tx_handle_ == nullptr || !output_enabled_) {
+        return;
+    }
+
+    // Power save and EnableOutput(false) may have stopped the channel already, there is nothing to flush then
+    esp_err_t err = i2s_channel_disable(tx_handle_);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Skip output flush, TX channel is not running: %s", esp_err_to_name(err));
+        return;
+    }
+
+    // Ramp from the last written sample down to zero to avoid a click, then fill the rest of the ring with silence
+    int fade_samples = output_sample_rate_ * AUDIO_CODEC_FADE_OUT_MS / 1000 * output_channels_;
+    std::vector<int16_t> fade(fade_samples);
+    for (int i = 0; i < fade_samples; i++) {
+        fade[i] = (int32_t)last_output_sample_ * (fade_samples - i) / fade_samples;
+    }
+    Preload(fade.data(), fade.size());
+    last_output_sample_ = 0;
+
+    uint8_t zeros[256] = {0};
+    size_t bytes_loaded;
+    do {
+        bytes_loaded = 0;
+        i2s_channel_preload_data(tx_handle_, zeros, sizeof(zeros), &bytes_loaded);
+    } while (bytes_loaded > 0);
+
+    err = i2s_channel_enable(tx_handle_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to re-enable TX channel after flush: %s", esp_err_to_name(err));
+    }
+}
+
+int AudioCodec::Preload(const int16_t* data, int samples) {
+    size_t bytes_loaded = 0;
+    i2s_channel_preload_data(tx_handle_, data, samples * sizeof(int16_t), &bytes_loaded);
+    return bytes_loaded / sizeof(int16_t);
+}
+
 bool AudioCodec::InputData(std::vector<int16_t>& data) {
     int samples = Read(data.data(), data.size());
     if (samples > 0) {
@@ -48,6 +94,9 @@ void AudioCodec::SetOutputVolume(int volume) {
     
     Settings settings("audio", true);
     settings.SetInt("output_volume", output_volume_);
+    if (on_output_volume_changed_) {
+        on_output_volume_changed_(output_volume_);
+    }
 }
 
 void AudioCodec::EnableInput(bool enable) {
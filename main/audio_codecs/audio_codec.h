@@ -14,6 +14,7 @@
 #define AUDIO_CODEC_DMA_DESC_NUM 6
 #define AUDIO_CODEC_DMA_FRAME_NUM 240
 #define AUDIO_CODEC_DEFAULT_MIC_GAIN 30.0
+#define AUDIO_CODEC_FADE_OUT_MS 5
 
 class AudioCodec {
 public:
@@ -25,8 +26,11 @@ public:
     virtual void EnableOutput(bool enable);
 
     virtual void OutputData(std::vector<int16_t>& data);
+    virtual void FlushOutput();
     virtual bool InputData(std::vector<int16_t>& data);
     virtual void Start();
+    // Called after every volume change, the status bar listens to it instead of polling
+    void OnOutputVolumeChanged(std::function<void(int volume)> callback) { on_output_volume_changed_ = callback; }
 
     inline bool duplex() const { return duplex_; }
     inline bool input_reference() const { return input_reference_; }
@@ -51,9 +55,12 @@ protected:
     int input_channels_ = 1;
     int output_channels_ = 1;
     int output_volume_ = 70;
+    int16_t last_output_sample_ = 0;
+    std::function<void(int volume)> on_output_volume_changed_;
 
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
+    virtual int Preload(const int16_t* data, int samples);
 };
 
 #endif // _AUDIO_CODEC_H
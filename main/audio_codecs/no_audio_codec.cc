@@ -335,28 +335,40 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
     ESP_LOGI(TAG, "Simplex channels created");
 }
 
-int NoAudioCodec::Write(const int16_t* data, int samples) {
-    std::vector<int32_t> buffer(samples);
-
+void NoAudioCodec::ApplyVolume(const int16_t* data, int32_t* dest, int samples) {
     // output_volume_: 0-100
     // volume_factor_: 0-65536
     int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
     for (int i = 0; i < samples; i++) {
         int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
         if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
+            dest[i] = INT32_MAX;
         } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
+            dest[i] = INT32_MIN;
         } else {
-            buffer[i] = static_cast<int32_t>(temp);
+            dest[i] = static_cast<int32_t>(temp);
         }
     }
+}
+
+int NoAudioCodec::Write(const int16_t* data, int samples) {
+    std::vector<int32_t> buffer(samples);
+    ApplyVolume(data, buffer.data(), samples);
 
     size_t bytes_written;
     ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
     return bytes_written / sizeof(int32_t);
 }
 
+int NoAudioCodec::Preload(const int16_t* data, int samples) {
+    std::vector<int32_t> buffer(samples);
+    ApplyVolume(data, buffer.data(), samples);
+
+    size_t bytes_loaded = 0;
+    i2s_channel_preload_data(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_loaded);
+    return bytes_loaded / sizeof(int32_t);
+}
+
 int NoAudioCodec::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
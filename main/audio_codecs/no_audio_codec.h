@@ -10,6 +10,9 @@ class NoAudioCodec : public AudioCodec {
 private:
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
+    virtual int Preload(const int16_t* data, int samples) override;
+
+    void ApplyVolume(const int16_t* data, int32_t* dest, int samples);
 
 public:
     virtual ~NoAudioCodec();
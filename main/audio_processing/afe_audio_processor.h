@@ -1,21 +1,19 @@
 #ifndef AFE_AUDIO_PROCESSOR_H
 #define AFE_AUDIO_PROCESSOR_H
 
-#include <esp_afe_sr_models.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
-#include <freertos/event_groups.h>
-
 #include <string>
 #include <vector>
+#include <memory>
 #include <functional>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
+#include "afe_frontend.h"
 
 class AfeAudioProcessor : public AudioProcessor {
 public:
     AfeAudioProcessor();
+    AfeAudioProcessor(std::shared_ptr<AfeFrontend> frontend);
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec) override;
@@ -23,21 +21,20 @@ public:
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) override;
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
 
 private:
-    EventGroupHandle_t event_group_ = nullptr;
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    std::shared_ptr<AfeFrontend> frontend_;
+    std::function<void(const int16_t* data, size_t samples)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
+    std::vector<int16_t> output_buffer_;
     AudioCodec* codec_ = nullptr;
     bool is_speaking_ = false;
 
-    void AudioProcessorTask();
+    void OnFetch(afe_fetch_result_t* res);
 };
 
-#endif 
\ No newline at end of file
+#endif 
@@ -0,0 +1,231 @@
+#include "afe_frontend.h"
+
+#include <esp_log.h>
+#include <model_path.h>
+#include <sstream>
+#include <cstring>
+
+#define WAKE_WORD_RUNNING_EVENT (1 << 0)
+#define OUTPUT_RUNNING_EVENT (1 << 1)
+
+#define TAG "AfeFrontend"
+
+AfeFrontend::AfeFrontend(afe_type_t type) : type_(type) {
+    event_group_ = xEventGroupCreate();
+}
+
+AfeFrontend::~AfeFrontend() {
+    if (afe_data_ != nullptr) {
+        afe_iface_->destroy(afe_data_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+void AfeFrontend::Initialize(AudioCodec* codec) {
+    // Shared by the wake word and the audio processor, only the first caller creates the instance
+    if (afe_data_ != nullptr) {
+        return;
+    }
+
+    codec_ = codec;
+    int ref_num = codec_->input_reference() ? 1 : 0;
+
+    std::string input_format;
+    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
+        input_format.push_back('M');
+    }
+    for (int i = 0; i < ref_num; i++) {
+        input_format.push_back('R');
+    }
+
+    srmodel_list_t *models = esp_srmodel_init("model");
+    char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
+
+    // The VC settings (VAD and NS) also apply to an SR front-end that feeds the audio processor
+#if CONFIG_USE_SHARED_AFE
+    bool voice_communication = true;
+#else
+    bool voice_communication = type_ == AFE_TYPE_VC;
+#endif
+
+    afe_config_t* afe_config;
+    if (type_ == AFE_TYPE_SR) {
+        for (int i = 0; i < models->num; i++) {
+            ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
+            if (strstr(models->model_name[i], ESP_WN_PREFIX) != NULL) {
+                auto words = esp_srmodel_get_wake_words(models, models->model_name[i]);
+                // split by ";" to get all wake words
+                std::stringstream ss(words);
+                std::string word;
+                while (std::getline(ss, word, ';')) {
+                    wake_words_.push_back(word);
+                }
+            }
+        }
+
+        // WakeNet needs the SR AEC for barge-in. A shared instance hands the same AEC output to the
+        // uplink, USE_SHARED_AFE excludes USE_DEVICE_AEC so the VOIP AEC never has to be swapped for it.
+        afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
+        afe_config->aec_init = codec_->input_reference();
+        afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
+    } else {
+        afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
+        afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
+        afe_config->agc_init = false;
+#ifdef CONFIG_USE_DEVICE_AEC
+        afe_config->aec_init = true;
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+        // Silence suppression gates the uplink with the VAD, so keep it running next to the AEC
+        afe_config->vad_init = true;
+#else
+        afe_config->vad_init = false;
+#endif
+#else
+        afe_config->aec_init = false;
+        afe_config->vad_init = true;
+#endif
+    }
+
+    if (voice_communication) {
+        if (type_ == AFE_TYPE_SR) {
+            afe_config->vad_init = true;
+        }
+        afe_config->vad_mode = VAD_MODE_0;
+        afe_config->vad_min_noise_ms = 100;
+
+        if (ns_model_name != nullptr) {
+            afe_config->ns_init = true;
+            afe_config->ns_model_name = ns_model_name;
+            afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+        } else {
+            afe_config->ns_init = false;
+        }
+    }
+
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    afe_data_ = afe_iface_->create_from_config(afe_config);
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (AfeFrontend*)arg;
+        this_->AudioFetchTask();
+        vTaskDelete(NULL);
+    }, type_ == AFE_TYPE_SR ? "audio_detection" : "audio_communication", 4096, this, 3, nullptr);
+}
+
+size_t AfeFrontend::GetFeedSize() {
+    if (afe_data_ == nullptr) {
+        return 0;
+    }
+    return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
+}
+
+void AfeFrontend::Feed(const std::vector<int16_t>& data) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    afe_iface_->feed(afe_data_, data.data());
+}
+
+void AfeFrontend::OnWakeWordFetch(std::function<void(afe_fetch_result_t* res)> callback) {
+    wake_word_callback_ = callback;
+}
+
+void AfeFrontend::OnOutputFetch(std::function<void(afe_fetch_result_t* res)> callback) {
+    output_callback_ = callback;
+}
+
+void AfeFrontend::EnableWakeWord(bool enable) {
+    if (enable) {
+        if (type_ == AFE_TYPE_SR && afe_data_ != nullptr) {
+            afe_iface_->enable_wakenet(afe_data_);
+        }
+        xEventGroupSetBits(event_group_, WAKE_WORD_RUNNING_EVENT);
+    } else {
+        xEventGroupClearBits(event_group_, WAKE_WORD_RUNNING_EVENT);
+        // WakeNet is the most expensive stage, skip it while only the output consumer is listening
+        if (type_ == AFE_TYPE_SR && afe_data_ != nullptr) {
+            afe_iface_->disable_wakenet(afe_data_);
+        }
+        ResetBuffer();
+    }
+}
+
+void AfeFrontend::EnableOutput(bool enable) {
+    if (enable) {
+        xEventGroupSetBits(event_group_, OUTPUT_RUNNING_EVENT);
+    } else {
+        xEventGroupClearBits(event_group_, OUTPUT_RUNNING_EVENT);
+        ResetBuffer();
+    }
+}
+
+bool AfeFrontend::IsWakeWordEnabled() {
+    return xEventGroupGetBits(event_group_) & WAKE_WORD_RUNNING_EVENT;
+}
+
+bool AfeFrontend::IsOutputEnabled() {
+    return xEventGroupGetBits(event_group_) & OUTPUT_RUNNING_EVENT;
+}
+
+void AfeFrontend::ResetBuffer() {
+    // Keep the buffered audio while the other consumer is still reading it
+    if (afe_data_ == nullptr || IsWakeWordEnabled() || IsOutputEnabled()) {
+        return;
+    }
+    afe_iface_->reset_buffer(afe_data_);
+}
+
+void AfeFrontend::EnableDeviceAec(bool enable) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+#if CONFIG_USE_SHARED_AFE
+    // The AEC of the shared instance also feeds WakeNet, turning it off would break barge-in
+    ESP_LOGW(TAG, "Device AEC cannot be toggled on the shared AFE, ignored");
+    return;
+#endif
+    if (enable) {
+#if CONFIG_USE_DEVICE_AEC
+#if !CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+        afe_iface_->disable_vad(afe_data_);
+#endif
+        afe_iface_->enable_aec(afe_data_);
+#else
+        ESP_LOGE(TAG, "Device AEC is not supported");
+#endif
+    } else {
+        afe_iface_->disable_aec(afe_data_);
+        afe_iface_->enable_vad(afe_data_);
+    }
+}
+
+void AfeFrontend::AudioFetchTask() {
+    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
+    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
+    ESP_LOGI(TAG, "Audio fetch task started, feed size: %d fetch size: %d",
+        feed_size, fetch_size);
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, WAKE_WORD_RUNNING_EVENT | OUTPUT_RUNNING_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+
+        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            if (res != nullptr) {
+                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+            }
+            continue;
+        }
+
+        auto bits = xEventGroupGetBits(event_group_);
+        if ((bits & WAKE_WORD_RUNNING_EVENT) && wake_word_callback_) {
+            wake_word_callback_(res);
+        }
+        if ((bits & OUTPUT_RUNNING_EVENT) && output_callback_) {
+            output_callback_(res);
+        }
+    }
+}
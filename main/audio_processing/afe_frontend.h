@@ -0,0 +1,51 @@
+#ifndef AFE_FRONTEND_H
+#define AFE_FRONTEND_H
+
+#include <esp_afe_sr_models.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "audio_codec.h"
+
+// Owns one esp_afe instance and its fetch task, and fans the fetch results out to
+// the wake word and the voice communication consumers. When both consumers share
+// one AFE_TYPE_SR front-end, AEC and NS run once and stay warm across state switches.
+class AfeFrontend {
+public:
+    AfeFrontend(afe_type_t type);
+    ~AfeFrontend();
+
+    void Initialize(AudioCodec* codec);
+    void Feed(const std::vector<int16_t>& data);
+    size_t GetFeedSize();
+    void EnableDeviceAec(bool enable);
+
+    void OnWakeWordFetch(std::function<void(afe_fetch_result_t* res)> callback);
+    void OnOutputFetch(std::function<void(afe_fetch_result_t* res)> callback);
+    void EnableWakeWord(bool enable);
+    void EnableOutput(bool enable);
+    bool IsWakeWordEnabled();
+    bool IsOutputEnabled();
+    void ResetBuffer();
+
+    inline const std::vector<std::string>& wake_words() const { return wake_words_; }
+
+private:
+    afe_type_t type_;
+    EventGroupHandle_t event_group_ = nullptr;
+    esp_afe_sr_iface_t* afe_iface_ = nullptr;
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    AudioCodec* codec_ = nullptr;
+    std::vector<std::string> wake_words_;
+    std::function<void(afe_fetch_result_t* res)> wake_word_callback_;
+    std::function<void(afe_fetch_result_t* res)> output_callback_;
+
+    void AudioFetchTask();
+};
+
+#endif // AFE_FRONTEND_H
@@ -5,22 +5,22 @@
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
 
-#include <esp_afe_sr_models.h>
-#include <esp_nsn_models.h>
-
 #include <list>
 #include <string>
 #include <vector>
+#include <memory>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "afe_frontend.h"
 
 class AfeWakeWord : public WakeWord {
 public:
     AfeWakeWord();
+    AfeWakeWord(std::shared_ptr<AfeFrontend> frontend);
     ~AfeWakeWord();
 
     void Initialize(AudioCodec* codec);
@@ -30,30 +30,29 @@ public:
     void StopDetection();
     bool IsDetectionRunning();
     size_t GetFeedSize();
-    void EncodeWakeWordData();
+    void EncodeWakeWordData(int frame_duration);
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
-    char* wakenet_model_ = NULL;
-    std::vector<std::string> wake_words_;
-    EventGroupHandle_t event_group_;
+    std::shared_ptr<AfeFrontend> frontend_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
 
     TaskHandle_t wake_word_encode_task_ = nullptr;
+    int encode_frame_duration_ = 60;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
     std::list<std::vector<int16_t>> wake_word_pcm_;
     std::list<std::vector<uint8_t>> wake_word_opus_;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
+    bool encoding_ = false;
 
     void StoreWakeWordData(const int16_t* data, size_t size);
-    void AudioDetectionTask();
+    void WaitForEncode();
+    void OnFetch(afe_fetch_result_t* res);
 };
 
 #endif
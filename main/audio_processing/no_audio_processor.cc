@@ -12,7 +12,7 @@ void NoAudioProcessor::Feed(const std::vector<int16_t>& data) {
         return;
     }
     // 直接将输入数据传递给输出回调
-    output_callback_(std::vector<int16_t>(data));
+    output_callback_(data.data(), data.size());
 }
 
 void NoAudioProcessor::Start() {
@@ -27,7 +27,7 @@ bool NoAudioProcessor::IsRunning() {
     return is_running_;
 }
 
-void NoAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void NoAudioProcessor::OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) {
     output_callback_ = callback;
 }
 
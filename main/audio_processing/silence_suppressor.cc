@@ -0,0 +1,63 @@
+#include "silence_suppressor.h"
+
+#include <esp_log.h>
+
+#define TAG "SilenceSuppressor"
+
+void SilenceSuppressor::Reset(int frame_duration_ms) {
+    PrintStats();
+
+    preroll_frames_ = SILENCE_SUPPRESSOR_PREROLL_MS / frame_duration_ms;
+    hangover_frames_ = SILENCE_SUPPRESSOR_HANGOVER_MS / frame_duration_ms;
+    comfort_noise_frames_ = SILENCE_SUPPRESSOR_COMFORT_NOISE_INTERVAL_MS / frame_duration_ms;
+    // Start open, the first words of a turn usually arrive before the VAD has settled
+    hangover_left_ = hangover_frames_;
+    frames_since_sent_ = 0;
+    preroll_.clear();
+
+    packets_in_ = 0;
+    packets_out_ = 0;
+    bytes_in_ = 0;
+    bytes_out_ = 0;
+}
+
+void SilenceSuppressor::OnVadStateChange(bool speaking) {
+    speaking_ = speaking;
+}
+
+void SilenceSuppressor::Process(std::list<AudioStreamPacket>& packets) {
+    packets_in_++;
+    bytes_in_ += packets.back().payload.size();
+
+    if (speaking_) {
+        hangover_left_ = hangover_frames_;
+        // Send the frames held back during silence first, so the word onset is not clipped
+        packets.splice(packets.begin(), preroll_);
+    } else if (hangover_left_ > 0) {
+        hangover_left_--;
+    } else if (++frames_since_sent_ >= comfort_noise_frames_) {
+        // Frames older than the comfort noise frame must not be sent after it
+        preroll_.clear();
+    } else {
+        preroll_.splice(preroll_.end(), packets);
+        while ((int)preroll_.size() > preroll_frames_) {
+            preroll_.pop_front();
+        }
+        return;
+    }
+
+    frames_since_sent_ = 0;
+    for (auto& packet : packets) {
+        packets_out_++;
+        bytes_out_ += packet.payload.size();
+    }
+}
+
+void SilenceSuppressor::PrintStats() {
+    if (packets_in_ == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink sent %u/%u packets, %u/%u bytes (%u%% saved)",
+        packets_out_, packets_in_, bytes_out_, bytes_in_,
+        bytes_in_ > 0 ? (unsigned)(100 - bytes_out_ * 100 / bytes_in_) : 0);
+}
@@ -0,0 +1,39 @@
+#ifndef SILENCE_SUPPRESSOR_H
+#define SILENCE_SUPPRESSOR_H
+
+#include <list>
+#include <atomic>
+
+#include "protocol.h"
+
+#define SILENCE_SUPPRESSOR_PREROLL_MS 180
+#define SILENCE_SUPPRESSOR_HANGOVER_MS 600
+#define SILENCE_SUPPRESSOR_COMFORT_NOISE_INTERVAL_MS 400
+
+// Gates encoded uplink frames with the VAD state, so long silences in realtime mode
+// only cost a comfort noise frame every few hundred milliseconds.
+class SilenceSuppressor {
+public:
+    void Reset(int frame_duration_ms);
+    void OnVadStateChange(bool speaking);
+    // Filter one encoded frame, `packets` holds the frame on entry and the packets to send on return.
+    // Nodes are moved with splice so the pooled payload buffers survive.
+    void Process(std::list<AudioStreamPacket>& packets);
+    void PrintStats();
+
+private:
+    std::atomic<bool> speaking_ = false;
+    int preroll_frames_ = 0;
+    int hangover_frames_ = 0;
+    int comfort_noise_frames_ = 0;
+    int hangover_left_ = 0;
+    int frames_since_sent_ = 0;
+    std::list<AudioStreamPacket> preroll_;
+
+    size_t packets_in_ = 0;
+    size_t packets_out_ = 0;
+    size_t bytes_in_ = 0;
+    size_t bytes_out_ = 0;
+};
+
+#endif // SILENCE_SUPPRESSOR_H
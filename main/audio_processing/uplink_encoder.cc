@@ -0,0 +1,207 @@
+#include "uplink_encoder.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "UplinkEncoder"
+
+UplinkEncoder::UplinkEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    int error;
+    audio_enc_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (audio_enc_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    SetDtx(true);
+    SetComplexity(0);
+
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+    free_frames_ = xQueueCreate(UPLINK_ENCODER_FRAME_POOL_SIZE, sizeof(int));
+    ready_frames_ = xQueueCreate(UPLINK_ENCODER_FRAME_POOL_SIZE, sizeof(int));
+    for (int i = 0; i < UPLINK_ENCODER_FRAME_POOL_SIZE; i++) {
+        frames_[i].resize(frame_size_);
+        xQueueSend(free_frames_, &i, 0);
+    }
+
+    // Opus needs a deep stack, keep it in PSRAM when there is one, internal RAM otherwise (esp32c3 etc.)
+    encode_task_stack_ = (StackType_t*)heap_caps_malloc(UPLINK_ENCODER_TASK_STACK_SIZE, MALLOC_CAP_SPIRAM);
+    if (encode_task_stack_ == nullptr) {
+        encode_task_stack_ = (StackType_t*)heap_caps_malloc(UPLINK_ENCODER_TASK_STACK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (encode_task_stack_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for the encode task stack", UPLINK_ENCODER_TASK_STACK_SIZE);
+        return;
+    }
+    encode_task_ = xTaskCreateStatic([](void* arg) {
+        auto this_ = (UplinkEncoder*)arg;
+        this_->EncodeTask();
+    }, "audio_encode", UPLINK_ENCODER_TASK_STACK_SIZE, this, 2, encode_task_stack_, &encode_task_buffer_);
+}
+
+UplinkEncoder::~UplinkEncoder() {
+    if (encode_task_ != nullptr) {
+        vTaskDelete(encode_task_);
+    }
+    if (encode_task_stack_ != nullptr) {
+        heap_caps_free(encode_task_stack_);
+    }
+    if (free_frames_ != nullptr) {
+        vQueueDelete(free_frames_);
+    }
+    if (ready_frames_ != nullptr) {
+        vQueueDelete(ready_frames_);
+    }
+    if (audio_enc_ != nullptr) {
+        opus_encoder_destroy(audio_enc_);
+    }
+}
+
+void UplinkEncoder::SetDuration(int duration_ms) {
+    std::lock_guard<std::mutex> encoder_lock(encoder_mutex_);
+    std::lock_guard<std::mutex> frame_lock(frame_mutex_);
+    if (duration_ms == duration_ms_) {
+        return;
+    }
+    PrintStats();
+    ESP_LOGI(TAG, "Frame duration changed from %d ms to %d ms", duration_ms_, duration_ms);
+    session_++;
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate_ / 1000 * channels_ * duration_ms;
+
+    // Drop the partially filled frame and the frames not encoded yet, they have the old size
+    int index;
+    while (xQueueReceive(ready_frames_, &index, 0) == pdTRUE) {
+        xQueueSend(free_frames_, &index, 0);
+    }
+    if (filling_frame_ >= 0) {
+        xQueueSend(free_frames_, &filling_frame_, 0);
+        filling_frame_ = -1;
+    }
+    filled_samples_ = 0;
+    for (auto& frame : frames_) {
+        frame.resize(frame_size_);
+    }
+    opus_encoder_ctl(audio_enc_, OPUS_RESET_STATE);
+}
+
+void UplinkEncoder::SetDtx(bool enable) {
+    std::lock_guard<std::mutex> lock(encoder_mutex_);
+    opus_encoder_ctl(audio_enc_, OPUS_SET_DTX(enable ? 1 : 0));
+}
+
+void UplinkEncoder::SetComplexity(int complexity) {
+    std::lock_guard<std::mutex> lock(encoder_mutex_);
+    opus_encoder_ctl(audio_enc_, OPUS_SET_COMPLEXITY(complexity));
+}
+
+void UplinkEncoder::ResetState(std::function<void()> on_reset) {
+    std::lock_guard<std::mutex> encoder_lock(encoder_mutex_);
+    std::lock_guard<std::mutex> frame_lock(frame_mutex_);
+    opus_encoder_ctl(audio_enc_, OPUS_RESET_STATE);
+    // A frame EncodeTask already took from the queue is dropped by its stamp
+    session_++;
+
+    // Return the frames of the previous session to the pool
+    int index;
+    while (xQueueReceive(ready_frames_, &index, 0) == pdTRUE) {
+        xQueueSend(free_frames_, &index, 0);
+    }
+    filled_samples_ = 0;
+    if (on_reset) {
+        on_reset();
+    }
+}
+
+void UplinkEncoder::OnEncoded(std::function<void(const uint8_t* opus, size_t size)> callback) {
+    encoded_callback_ = callback;
+}
+
+void UplinkEncoder::Write(const int16_t* data, size_t samples) {
+    if (audio_enc_ == nullptr || encode_task_ == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    while (samples > 0) {
+        if (filling_frame_ < 0) {
+            if (xQueueReceive(free_frames_, &filling_frame_, 0) != pdTRUE) {
+                // The encoder is behind, drop the newest audio rather than block the AFE
+                filling_frame_ = -1;
+                dropped_frames_++;
+                return;
+            }
+            filled_samples_ = 0;
+        }
+
+        size_t count = std::min(samples, (size_t)frame_size_ - filled_samples_);
+        memcpy(frames_[filling_frame_].data() + filled_samples_, data, count * sizeof(int16_t));
+        filled_samples_ += count;
+        data += count;
+        samples -= count;
+
+        if (filled_samples_ == (size_t)frame_size_) {
+            frame_ready_time_[filling_frame_] = esp_timer_get_time();
+            frame_session_[filling_frame_] = session_;
+            xQueueSend(ready_frames_, &filling_frame_, 0);
+            filling_frame_ = -1;
+        }
+    }
+}
+
+void UplinkEncoder::EncodeTask() {
+    while (true) {
+        int index;
+        if (xQueueReceive(ready_frames_, &index, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(encoder_mutex_);
+        if (frame_session_[index] != session_) {
+            // Taken from the queue just before a reset, it belongs to the previous session
+            xQueueSend(free_frames_, &index, 0);
+            continue;
+        }
+        auto start_time = esp_timer_get_time();
+        auto ret = opus_encode(audio_enc_, frames_[index].data(), frame_size_, packet_, sizeof(packet_));
+        auto end_time = esp_timer_get_time();
+        auto latency = end_time - frame_ready_time_[index];
+        xQueueSend(free_frames_, &index, 0);
+
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+            continue;
+        }
+
+        encoded_frames_++;
+        total_encode_us_ += end_time - start_time;
+        total_bytes_ += ret;
+        total_latency_us_ += latency;
+        if (latency > max_latency_us_) {
+            max_latency_us_ = latency;
+        }
+        // Still under encoder_mutex_, so ResetState() never interleaves with the callback
+        if (encoded_callback_) {
+            encoded_callback_(packet_, ret);
+        }
+    }
+}
+
+void UplinkEncoder::PrintStats() {
+    if (encoded_frames_ == 0) {
+        return;
+    }
+    // Encode time per second of audio approximates the CPU share of the encoder at this frame duration
+    int64_t audio_ms = (int64_t)encoded_frames_ * duration_ms_;
+    ESP_LOGI(TAG, "Encoded %u frames of %d ms, dropped %u, latency avg %ld us max %ld us, cpu %ld us/s, %ld bytes/s",
+        encoded_frames_, duration_ms_, dropped_frames_, (long)(total_latency_us_ / encoded_frames_), (long)max_latency_us_,
+        (long)(total_encode_us_ * 1000 / audio_ms), (long)(total_bytes_ * 1000 / audio_ms));
+    encoded_frames_ = 0;
+    dropped_frames_ = 0;
+    total_latency_us_ = 0;
+    max_latency_us_ = 0;
+    total_encode_us_ = 0;
+    total_bytes_ = 0;
+}
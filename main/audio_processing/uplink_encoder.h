@@ -0,0 +1,76 @@
+#ifndef UPLINK_ENCODER_H
+#define UPLINK_ENCODER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <opus.h>
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+#define UPLINK_ENCODER_FRAME_POOL_SIZE 4
+#define UPLINK_ENCODER_MAX_PACKET_SIZE 1276
+#define UPLINK_ENCODER_TASK_STACK_SIZE (4096 * 7)
+
+// Encodes the processed microphone audio on a dedicated task.
+// PCM frames come from a fixed pool and are filled straight from the AFE output,
+// Opus packets are written into a fixed buffer, so the steady state does not allocate.
+class UplinkEncoder {
+public:
+    UplinkEncoder(int sample_rate, int channels, int duration_ms);
+    ~UplinkEncoder();
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+    // Switch to a new frame duration (20/40/60 ms), the pooled frames keep their capacity
+    void SetDuration(int duration_ms);
+    void SetDtx(bool enable);
+    void SetComplexity(int complexity);
+    // Drops the frames not encoded yet. on_reset runs with no encoded callback in flight,
+    // use it to reset the state the callback works on.
+    void ResetState(std::function<void()> on_reset = nullptr);
+    // Called from the audio processor task, copies samples into the pooled frame being filled
+    void Write(const int16_t* data, size_t samples);
+    void OnEncoded(std::function<void(const uint8_t* opus, size_t size)> callback);
+    void PrintStats();
+
+private:
+    OpusEncoder* audio_enc_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+    std::mutex encoder_mutex_;
+    std::mutex frame_mutex_;
+    std::function<void(const uint8_t* opus, size_t size)> encoded_callback_;
+
+    std::array<std::vector<int16_t>, UPLINK_ENCODER_FRAME_POOL_SIZE> frames_;
+    std::array<int64_t, UPLINK_ENCODER_FRAME_POOL_SIZE> frame_ready_time_;
+    // Bumped by ResetState() and SetDuration() under both mutexes, stamped on each frame when it is filled
+    uint32_t session_ = 0;
+    std::array<uint32_t, UPLINK_ENCODER_FRAME_POOL_SIZE> frame_session_ = {};
+    QueueHandle_t free_frames_ = nullptr;
+    QueueHandle_t ready_frames_ = nullptr;
+    int filling_frame_ = -1;
+    size_t filled_samples_ = 0;
+    uint8_t packet_[UPLINK_ENCODER_MAX_PACKET_SIZE];
+
+    TaskHandle_t encode_task_ = nullptr;
+    StaticTask_t encode_task_buffer_;
+    StackType_t* encode_task_stack_ = nullptr;
+
+    size_t encoded_frames_ = 0;
+    size_t dropped_frames_ = 0;
+    int64_t total_latency_us_ = 0;
+    int64_t max_latency_us_ = 0;
+    int64_t total_encode_us_ = 0;
+    size_t total_bytes_ = 0;
+
+    void EncodeTask();
+};
+
+#endif // UPLINK_ENCODER_H
@@ -18,7 +18,9 @@ public:
     virtual void StopDetection() = 0;
     virtual bool IsDetectionRunning() = 0;
     virtual size_t GetFeedSize() = 0;
-    virtual void EncodeWakeWordData() = 0;
+    // Encode the buffered wake word audio with the uplink frame duration of the session.
+    // May be called again with another duration until detection restarts, the packets are then replaced.
+    virtual void EncodeWakeWordData(int frame_duration) = 0;
     virtual bool GetWakeWordOpus(std::vector<uint8_t>& opus) = 0;
     virtual const std::string& GetLastDetectedWakeWord() const = 0;
 };
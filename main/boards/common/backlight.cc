@@ -78,6 +78,9 @@ void Backlight::OnTransitionTimer() {
 
     if (brightness_ == target_brightness_) {
         esp_timer_stop(transition_timer_);
+        if (on_brightness_changed_) {
+            on_brightness_changed_(brightness_);
+        }
     }
 }
 
@@ -15,6 +15,8 @@ public:
     void RestoreBrightness();
     void SetBrightness(uint8_t brightness, bool permanent = false);
     inline uint8_t brightness() const { return brightness_; }
+    // Called when a transition reaches the new brightness
+    void OnBrightnessChanged(std::function<void(uint8_t brightness)> callback) { on_brightness_changed_ = callback; }
 
 protected:
     void OnTransitionTimer();
@@ -24,6 +26,7 @@ protected:
     uint8_t brightness_ = 0;
     uint8_t target_brightness_ = 0;
     uint8_t step_ = 1;
+    std::function<void(uint8_t brightness)> on_brightness_changed_;
 };
 
 
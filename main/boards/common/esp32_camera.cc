@@ -6,8 +6,10 @@
 
 #include <esp_log.h>
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include <img_converters.h>
 #include <cstring>
+#include <algorithm>
 
 #define TAG "Esp32Camera"
 
@@ -23,59 +25,17 @@ Esp32Camera::Esp32Camera(const camera_config_t& config) {
     if (s->id.PID == GC0308_PID) {
         s->set_hmirror(s, 0);  // 这里控制摄像头镜像 写1镜像 写0不镜像
     }
-
-    // 初始化预览图片的内存
-    memset(&preview_image_, 0, sizeof(preview_image_));
-    preview_image_.header.magic = LV_IMAGE_HEADER_MAGIC;
-    preview_image_.header.cf = LV_COLOR_FORMAT_RGB565;
-    preview_image_.header.flags = LV_IMAGE_FLAGS_ALLOCATED | LV_IMAGE_FLAGS_MODIFIABLE;
-
-    switch (config.frame_size) {
-        case FRAMESIZE_SVGA:
-            preview_image_.header.w = 800;
-            preview_image_.header.h = 600;
-            break;
-        case FRAMESIZE_VGA:
-            preview_image_.header.w = 640;
-            preview_image_.header.h = 480;
-            break;
-        case FRAMESIZE_QVGA:
-            preview_image_.header.w = 320;
-            preview_image_.header.h = 240;
-            break;
-        case FRAMESIZE_128X128:
-            preview_image_.header.w = 128;
-            preview_image_.header.h = 128;
-            break;
-        case FRAMESIZE_240X240:
-            preview_image_.header.w = 240;
-            preview_image_.header.h = 240;
-            break;
-        default:
-            ESP_LOGE(TAG, "Unsupported frame size: %d, image preview will not be shown", config.frame_size);
-            preview_image_.data_size = 0;
-            preview_image_.data = nullptr;
-            return;
-    }
-
-    preview_image_.header.stride = preview_image_.header.w * 2;
-    preview_image_.data_size = preview_image_.header.w * preview_image_.header.h * 2;
-    preview_image_.data = (uint8_t*)heap_caps_malloc(preview_image_.data_size, MALLOC_CAP_SPIRAM);
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Failed to allocate memory for preview image");
-        return;
-    }
 }
 
 Esp32Camera::~Esp32Camera() {
+    if (encoder_task_ != nullptr) {
+        vTaskDelete(encoder_task_);
+        FreeEncoderBuffers();
+    }
     if (fb_) {
         esp_camera_fb_return(fb_);
         fb_ = nullptr;
     }
-    if (preview_image_.data) {
-        heap_caps_free((void*)preview_image_.data);
-        preview_image_.data = nullptr;
-    }
     esp_camera_deinit();
 }
 
@@ -84,11 +44,41 @@ void Esp32Camera::SetExplainUrl(const std::string& url, const std::string& token
     explain_token_ = token;
 }
 
-bool Esp32Camera::Capture() {
-    if (encoder_thread_.joinable()) {
-        encoder_thread_.join();
+// Largest integer downscale that keeps the preview at least as big as a chat image bubble
+static int GetPreviewScale(int width, int height, int display_width, int display_height) {
+    int max_width = std::max(display_width * 70 / 100, 1);
+    int max_height = std::max(display_height * 50 / 100, 1);
+    return std::max(1, std::min(width / max_width, height / max_height));
+}
+
+// Byte swap the big endian sensor pixels and downscale in the same pass
+static void ConvertPreview(const uint16_t* src, int src_width, uint16_t* dst, int width, int height, int scale) {
+    if (scale == 1) {
+        // Two pixels per 32-bit word
+        size_t pixel_count = (size_t)width * height;
+        auto src32 = (const uint32_t*)src;
+        auto dst32 = (uint32_t*)dst;
+        for (size_t i = 0; i < pixel_count / 2; i++) {
+            uint32_t v = src32[i];
+            dst32[i] = ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF);
+        }
+        if (pixel_count % 2) {
+            dst[pixel_count - 1] = __builtin_bswap16(src[pixel_count - 1]);
+        }
+        return;
+    }
+    for (int y = 0; y < height; y++) {
+        auto row = src + (size_t)y * scale * src_width;
+        for (int x = 0; x < width; x++) {
+            dst[x] = __builtin_bswap16(row[x * scale]);
+        }
+        dst += width;
     }
+}
 
+bool Esp32Camera::Capture() {
+    // Explain drains the encoder before returning, so fb_ is free to be replaced
+    capture_time_ = esp_timer_get_time();
     int frames_to_get = 2;
     // Try to get a stable frame
     for (int i = 0; i < frames_to_get; i++) {
@@ -102,30 +92,31 @@ bool Esp32Camera::Capture() {
         }
     }
 
-    // 如果预览图片 buffer 为空，则跳过预览
+    // 非 RGB565 格式时跳过预览
     // 但仍返回 true，因为此时图像可以上传至服务器
-    if (preview_image_.data_size == 0) {
-        ESP_LOGW(TAG, "Skip preview because of unsupported frame size");
-        return true;
-    }
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Preview image data is not initialized");
+    if (fb_->format != PIXFORMAT_RGB565) {
+        ESP_LOGW(TAG, "Skip preview because of unsupported pixel format");
         return true;
     }
     // 显示预览图片
     auto display = Board::GetInstance().GetDisplay();
-    if (display != nullptr) {
-        auto src = (uint16_t*)fb_->buf;
-        auto dst = (uint16_t*)preview_image_.data;
-        size_t pixel_count = fb_->len / 2;
-        for (size_t i = 0; i < pixel_count; i++) {
-            // 交换每个16位字内的字节
-            dst[i] = __builtin_bswap16(src[i]);
+    if (display != nullptr && display->width() > 0) {
+        auto start_time = esp_timer_get_time();
+        int scale = GetPreviewScale(fb_->width, fb_->height, display->width(), display->height());
+        auto preview = std::make_unique<PreviewImage>(fb_->width / scale, fb_->height / scale);
+        if (preview->image.data == nullptr) {
+            return true;
         }
-        display->SetPreviewImage(&preview_image_);
+        ConvertPreview((const uint16_t*)fb_->buf, fb_->width, (uint16_t*)preview->image.data,
+            preview->image.header.w, preview->image.header.h, scale);
+        ESP_LOGI(TAG, "Preview %ux%u -> %ux%u (%lu bytes) in %ld us", fb_->width, fb_->height,
+            preview->image.header.w, preview->image.header.h, preview->image.data_size,
+            (long)(esp_timer_get_time() - start_time));
+        display->SetPreviewImage(std::move(preview));
     }
     return true;
 }
+
 bool Esp32Camera::SetHMirror(bool enabled) {
     sensor_t *s = esp_camera_sensor_get();
     if (s == nullptr) {
@@ -160,6 +151,103 @@ bool Esp32Camera::SetVFlip(bool enabled) {
     return true;
 }
 
+bool Esp32Camera::StartEncoder() {
+    if (encoder_task_ != nullptr) {
+        return true;
+    }
+    chunk_pool_ = (uint8_t*)heap_caps_aligned_alloc(16, JPEG_CHUNK_SIZE * JPEG_CHUNK_COUNT, MALLOC_CAP_SPIRAM);
+    encode_queue_ = xQueueCreate(1, sizeof(camera_fb_t*));
+    free_chunks_ = xQueueCreate(JPEG_CHUNK_COUNT, sizeof(JpegChunk));
+    // One more slot for the terminator
+    filled_chunks_ = xQueueCreate(JPEG_CHUNK_COUNT + 1, sizeof(JpegChunk));
+    if (chunk_pool_ == nullptr || encode_queue_ == nullptr || free_chunks_ == nullptr || filled_chunks_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate JPEG encoder buffers");
+        FreeEncoderBuffers();
+        return false;
+    }
+    for (int i = 0; i < JPEG_CHUNK_COUNT; i++) {
+        JpegChunk chunk = {
+            .data = chunk_pool_ + i * JPEG_CHUNK_SIZE,
+            .len = 0
+        };
+        xQueueSend(free_chunks_, &chunk, 0);
+    }
+    if (xTaskCreate([](void* arg) {
+        auto camera = (Esp32Camera*)arg;
+        camera->EncoderTask();
+    }, "jpeg_encoder", 4096, this, 2, &encoder_task_) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create JPEG encoder task");
+        encoder_task_ = nullptr;
+        FreeEncoderBuffers();
+        return false;
+    }
+    return true;
+}
+
+void Esp32Camera::FreeEncoderBuffers() {
+    heap_caps_free(chunk_pool_);
+    chunk_pool_ = nullptr;
+    for (auto queue : {&encode_queue_, &free_chunks_, &filled_chunks_}) {
+        if (*queue != nullptr) {
+            vQueueDelete(*queue);
+            *queue = nullptr;
+        }
+    }
+}
+
+void Esp32Camera::EncoderTask() {
+    camera_fb_t* fb;
+    while (xQueueReceive(encode_queue_, &fb, portMAX_DELAY) == pdPASS) {
+        current_chunk_ = {};
+        jpeg_size_ = 0;
+        auto start_time = esp_timer_get_time();
+        bool success = frame2jpg_cb(fb, jpeg_quality_, [](void* arg, size_t index, const void* data, size_t len) -> size_t {
+            return ((Esp32Camera*)arg)->WriteJpeg((const uint8_t*)data, len);
+        }, this);
+        if (current_chunk_.data != nullptr) {
+            xQueueSend(filled_chunks_, &current_chunk_, portMAX_DELAY);
+        }
+        ESP_LOGI(TAG, "JPEG %ux%u quality=%d size=%u in %ld ms", fb->width, fb->height, jpeg_quality_,
+            jpeg_size_, (long)((esp_timer_get_time() - start_time) / 1000));
+
+        // Aim the next photo at the target size, smaller uploads answer faster
+        if (success && jpeg_size_ > JPEG_TARGET_SIZE) {
+            jpeg_quality_ = std::max(JPEG_MIN_QUALITY, jpeg_quality_ - 10);
+        } else if (success && jpeg_size_ < JPEG_TARGET_SIZE / 2) {
+            jpeg_quality_ = std::min(JPEG_MAX_QUALITY, jpeg_quality_ + 5);
+        }
+
+        JpegChunk end = {
+            .data = nullptr,
+            .len = 0
+        };
+        xQueueSend(filled_chunks_, &end, portMAX_DELAY);
+    }
+    vTaskDelete(NULL);
+}
+
+// Encoder output is copied into the current chunk, full chunks go to the upload side
+size_t Esp32Camera::WriteJpeg(const uint8_t* data, size_t len) {
+    size_t remaining = len;
+    while (remaining > 0) {
+        if (current_chunk_.data == nullptr) {
+            xQueueReceive(free_chunks_, &current_chunk_, portMAX_DELAY);
+            current_chunk_.len = 0;
+        }
+        size_t size = std::min(remaining, JPEG_CHUNK_SIZE - current_chunk_.len);
+        memcpy(current_chunk_.data + current_chunk_.len, data, size);
+        current_chunk_.len += size;
+        data += size;
+        remaining -= size;
+        if (current_chunk_.len == JPEG_CHUNK_SIZE) {
+            xQueueSend(filled_chunks_, &current_chunk_, portMAX_DELAY);
+            current_chunk_.data = nullptr;
+        }
+    }
+    jpeg_size_ += len;
+    return len;
+}
+
 /**
  * @brief 将摄像头捕获的图像发送到远程服务器进行AI分析和解释
  * 
@@ -168,9 +256,10 @@ bool Esp32Camera::SetVFlip(bool enabled) {
  * 问题对图像进行AI分析并返回结果。
  * 
  * 实现特点：
- * - 使用独立线程编码JPEG，与主线程分离
+ * - 常驻编码任务编码JPEG，与建立HTTP连接、上传同时进行
+ * - 编码输出写入固定的PSRAM分块环，不再为每段数据分配内存
+ * - 根据上一张的大小调整JPEG质量；传感器直接输出JPEG时不再编码
  * - 采用分块传输编码(chunked transfer encoding)优化内存使用
- * - 通过队列机制实现编码线程和发送线程的数据同步
  * - 支持设备ID、客户端ID和认证令牌的HTTP头部配置
  * 
  * @param question 要向AI提出的关于图像的问题，将作为表单字段发送
@@ -180,7 +269,7 @@ bool Esp32Camera::SetVFlip(bool enabled) {
  *                  {"success": false, "message": "错误信息"}
  * 
  * @note 调用此函数前必须先调用SetExplainUrl()设置服务器URL
- * @note 函数会等待之前的编码线程完成后再开始新的处理
+ * @note 函数返回前会取完编码任务的全部输出
  * @warning 如果摄像头缓冲区为空或网络连接失败，将返回错误信息
  */
 std::string Esp32Camera::Explain(const std::string& question) {
@@ -188,28 +277,26 @@ std::string Esp32Camera::Explain(const std::string& question) {
         return "{\"success\": false, \"message\": \"Image explain URL or token is not set\"}";
     }
 
-    // 创建局部的 JPEG 队列, 40 entries is about to store 512 * 40 = 20480 bytes of JPEG data
-    QueueHandle_t jpeg_queue = xQueueCreate(40, sizeof(JpegChunk));
-    if (jpeg_queue == nullptr) {
-        ESP_LOGE(TAG, "Failed to create JPEG queue");
-        return "{\"success\": false, \"message\": \"Failed to create JPEG queue\"}";
+    if (fb_ == nullptr) {
+        return "{\"success\": false, \"message\": \"No photo captured\"}";
     }
 
-    // We spawn a thread to encode the image to JPEG
-    encoder_thread_ = std::thread([this, jpeg_queue]() {
-        frame2jpg_cb(fb_, 80, [](void* arg, size_t index, const void* data, size_t len) -> unsigned int {
-            auto jpeg_queue = (QueueHandle_t)arg;
-            JpegChunk chunk = {
-                .data = (uint8_t*)heap_caps_aligned_alloc(16, len, MALLOC_CAP_SPIRAM),
-                .len = len
-            };
-            memcpy(chunk.data, data, len);
-            xQueueSend(jpeg_queue, &chunk, portMAX_DELAY);
-            return len;
-        }, jpeg_queue);
-    });
+    auto start_time = esp_timer_get_time();
+    size_t internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t spiram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    size_t internal_min = internal_free;
+    size_t spiram_min = spiram_free;
 
-    auto http = Board::GetInstance().CreateHttp();
+    // 传感器已输出 JPEG 时直接上传, 否则交给编码任务, 编码与建立连接同时进行
+    bool encode = fb_->format != PIXFORMAT_JPEG;
+    if (encode) {
+        if (!StartEncoder()) {
+            return "{\"success\": false, \"message\": \"Failed to start JPEG encoder\"}";
+        }
+        xQueueSend(encode_queue_, &fb_, portMAX_DELAY);
+    }
+
+    auto http = std::unique_ptr<Http>(Board::GetInstance().CreateHttp());
     // 构造multipart/form-data请求体
     std::string boundary = "----ESP32_CAMERA_BOUNDARY";
     
@@ -241,17 +328,11 @@ std::string Esp32Camera::Explain(const std::string& question) {
     http->SetHeader("Transfer-Encoding", "chunked");
     if (!http->Open("POST", explain_url_)) {
         ESP_LOGE(TAG, "Failed to connect to explain URL");
-        // Clear the queue
-        encoder_thread_.join();
+        // Let the encoder finish and take back its chunks
         JpegChunk chunk;
-        while (xQueueReceive(jpeg_queue, &chunk, portMAX_DELAY) == pdPASS) {
-            if (chunk.data != nullptr) {
-                heap_caps_free(chunk.data);
-            } else {
-                break;
-            }
+        while (encode && xQueueReceive(filled_chunks_, &chunk, portMAX_DELAY) == pdPASS && chunk.data != nullptr) {
+            xQueueSend(free_chunks_, &chunk, portMAX_DELAY);
         }
-        vQueueDelete(jpeg_queue);
         return "{\"success\": false, \"message\": \"Failed to connect to explain URL\"}";
     }
     
@@ -263,9 +344,13 @@ std::string Esp32Camera::Explain(const std::string& question) {
     
     // 第三块：JPEG数据
     size_t total_sent = 0;
-    while (true) {
+    if (!encode) {
+        http->Write((const char*)fb_->buf, fb_->len);
+        total_sent = fb_->len;
+    }
+    while (encode) {
         JpegChunk chunk;
-        if (xQueueReceive(jpeg_queue, &chunk, portMAX_DELAY) != pdPASS) {
+        if (xQueueReceive(filled_chunks_, &chunk, portMAX_DELAY) != pdPASS) {
             ESP_LOGE(TAG, "Failed to receive JPEG chunk");
             break;
         }
@@ -274,12 +359,11 @@ std::string Esp32Camera::Explain(const std::string& question) {
         }
         http->Write((const char*)chunk.data, chunk.len);
         total_sent += chunk.len;
-        heap_caps_free(chunk.data);
+        xQueueSend(free_chunks_, &chunk, portMAX_DELAY);
+        internal_min = std::min(internal_min, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+        spiram_min = std::min(spiram_min, heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
     }
-    // Wait for the encoder thread to finish
-    encoder_thread_.join();
-    // 清理队列
-    vQueueDelete(jpeg_queue);
+    auto upload_time = esp_timer_get_time();
 
     // 第四块：multipart尾部
     http->Write(multipart_footer.c_str(), multipart_footer.size());
@@ -297,7 +381,11 @@ std::string Esp32Camera::Explain(const std::string& question) {
 
     // Get remain task stack size
     size_t remain_stack_size = uxTaskGetStackHighWaterMark(nullptr);
+    auto end_time = esp_timer_get_time();
     ESP_LOGI(TAG, "Explain image size=%dx%d, compressed size=%d, remain stack size=%d, question=%s\n%s",
         fb_->width, fb_->height, total_sent, remain_stack_size, question.c_str(), result.c_str());
+    ESP_LOGI(TAG, "Explain timing: photo->response %ld ms (upload %ld ms, response %ld ms), peak memory: internal %u, spiram %u",
+        (long)((end_time - capture_time_) / 1000), (long)((upload_time - start_time) / 1000),
+        (long)((end_time - upload_time) / 1000), internal_free - internal_min, spiram_free - spiram_min);
     return result;
 }
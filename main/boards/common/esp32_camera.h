@@ -3,14 +3,22 @@
 
 #include <esp_camera.h>
 #include <lvgl.h>
-#include <thread>
 #include <memory>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/task.h>
 
 #include "camera.h"
 
+// 编码输出写入固定的 PSRAM 分块环, 上传一块归还一块
+#define JPEG_CHUNK_SIZE (8 * 1024)
+#define JPEG_CHUNK_COUNT 4
+// Quality adapts so the JPEG stays below the target size
+#define JPEG_TARGET_SIZE (48 * 1024)
+#define JPEG_MIN_QUALITY 30
+#define JPEG_MAX_QUALITY 80
+
 struct JpegChunk {
     uint8_t* data;
     size_t len;
@@ -19,10 +27,24 @@ struct JpegChunk {
 class Esp32Camera : public Camera {
 private:
     camera_fb_t* fb_ = nullptr;
-    lv_img_dsc_t preview_image_;
     std::string explain_url_;
     std::string explain_token_;
-    std::thread encoder_thread_;
+    int64_t capture_time_ = 0;
+
+    // 常驻的 JPEG 编码任务
+    TaskHandle_t encoder_task_ = nullptr;
+    QueueHandle_t encode_queue_ = nullptr;
+    QueueHandle_t free_chunks_ = nullptr;
+    QueueHandle_t filled_chunks_ = nullptr;
+    uint8_t* chunk_pool_ = nullptr;
+    JpegChunk current_chunk_ = {};
+    size_t jpeg_size_ = 0;
+    int jpeg_quality_ = JPEG_MAX_QUALITY;
+
+    bool StartEncoder();
+    void FreeEncoderBuffers();
+    void EncoderTask();
+    size_t WriteJpeg(const uint8_t* data, size_t len);
 
 public:
     Esp32Camera(const camera_config_t& config);
@@ -2,6 +2,7 @@
 
 #include "display.h"
 #include "application.h"
+#include "mcp_server.h"
 #include "system_info.h"
 #include "font_awesome_symbols.h"
 #include "settings.h"
@@ -16,6 +17,8 @@
 #include <tls_transport.h>
 #include <web_socket.h>
 #include <esp_log.h>
+#include <esp_wifi.h>
+#include <esp_event.h>
 
 #include <wifi_station.h>
 #include <wifi_configuration_ap.h>
@@ -65,6 +68,31 @@ void WifiBoard::EnterWifiConfigMode() {
     }
 }
 
+// Arm RSSI_LOW at the lower edge of the current Wi-Fi icon band.
+// Armed again wherever the RSSI is read, so a signal that got stronger raises the event at the higher edge.
+static void ArmRssiThreshold(int8_t rssi) {
+    if (rssi >= -60) {
+        esp_wifi_set_rssi_threshold(-60);
+    } else if (rssi >= -70) {
+        esp_wifi_set_rssi_threshold(-70);
+    }
+}
+
+// The network icon follows connection and signal band changes,
+// a signal getting stronger is picked up by the status bar clock
+void WifiBoard::OnNetworkEvent(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    auto board = (WifiBoard*)arg;
+    // The default event loop task has a small stack, redraw and notify from the main task
+    Application::GetInstance().Schedule([board]() {
+        board->GetDisplay()->UpdateStatusBar(kStatusBarNetwork);
+        McpServer::GetInstance().NotifyStateChanged();
+    });
+    auto& wifi_station = WifiStation::GetInstance();
+    if (wifi_station.IsConnected()) {
+        ArmRssiThreshold(wifi_station.GetRssi());
+    }
+}
+
 void WifiBoard::StartNetwork() {
     // User can press BOOT button while starting to enter WiFi configuration mode
     if (wifi_config_mode_) {
@@ -113,6 +141,11 @@ void WifiBoard::StartNetwork() {
         EnterWifiConfigMode();
         return;
     }
+
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &WifiBoard::OnNetworkEvent, this);
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_BSS_RSSI_LOW, &WifiBoard::OnNetworkEvent, this);
+    esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &WifiBoard::OnNetworkEvent, this);
+    ArmRssiThreshold(wifi_station.GetRssi());
 }
 
 Http* WifiBoard::CreateHttp() {
@@ -147,6 +180,7 @@ const char* WifiBoard::GetNetworkStateIcon() {
         return FONT_AWESOME_WIFI_OFF;
     }
     int8_t rssi = wifi_station.GetRssi();
+    ArmRssiThreshold(rssi);
     if (rssi >= -60) {
         return FONT_AWESOME_WIFI;
     } else if (rssi >= -70) {
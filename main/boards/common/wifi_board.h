@@ -1,6 +1,8 @@
 #ifndef WIFI_BOARD_H
 #define WIFI_BOARD_H
 
+#include <esp_event.h>
+
 #include "board.h"
 #include "extend/chat_web_server/web_server.h"
 
@@ -8,6 +10,7 @@ class WifiBoard : public Board {
 protected:
     bool wifi_config_mode_ = false;
     void EnterWifiConfigMode();
+    static void OnNetworkEvent(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
     virtual std::string GetBoardJson() override;
 
 public:
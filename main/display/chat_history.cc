@@ -0,0 +1,157 @@
+#include "chat_history.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "ChatHistory"
+
+ChatHistory::ChatHistory(size_t capacity, size_t max_entries)
+    : capacity_(capacity), max_entries_(max_entries) {
+    buffer_ = (char*)heap_caps_malloc(capacity_, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr) {
+        // Fallback to internal RAM if SPIRAM allocation fails
+        buffer_ = (char*)heap_caps_malloc(capacity_, MALLOC_CAP_8BIT);
+    }
+    entries_ = (Entry*)heap_caps_malloc(max_entries_ * sizeof(Entry), MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr || entries_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate chat history (%u bytes)", capacity_);
+        capacity_ = 0;
+    }
+}
+
+ChatHistory::~ChatHistory() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+    if (entries_ != nullptr) {
+        heap_caps_free(entries_);
+    }
+}
+
+void ChatHistory::PopFront() {
+    first_ = (first_ + 1) % max_entries_;
+    count_--;
+    if (count_ == 0) {
+        first_ = 0;
+        head_ = 0;
+    }
+}
+
+// A single message may use a quarter of the buffer, cut on a UTF-8 boundary
+size_t ChatHistory::LimitLength(const char* text, size_t used) const {
+    size_t length = strlen(text);
+    size_t max_length = std::min(capacity_ / 4, (size_t)UINT16_MAX) - used;
+    if (length > max_length) {
+        length = max_length;
+        while (length > 0 && (text[length] & 0xC0) == 0x80) {
+            length--;
+        }
+    }
+    return length;
+}
+
+void ChatHistory::Append(uint8_t role, const char* text) {
+    if (capacity_ == 0) {
+        return;
+    }
+
+    size_t length = LimitLength(text, 0);
+    size_t needed = length + 1;
+
+    if (count_ == max_entries_) {
+        PopFront();
+    }
+
+    size_t start = head_;
+    if (start + needed > capacity_) {
+        // Not enough room at the tail, the messages stored there are the oldest ones
+        while (count_ > 0 && entry(0).offset >= start) {
+            PopFront();
+        }
+        start = 0;
+    }
+    // Evict the oldest messages overlapping the new text
+    while (count_ > 0) {
+        auto& oldest = entry(0);
+        if (oldest.offset < start + needed && start < oldest.offset + oldest.length + 1u) {
+            PopFront();
+        } else {
+            break;
+        }
+    }
+
+    memcpy(buffer_ + start, text, length);
+    buffer_[start + length] = '\0';
+    entries_[(first_ + count_) % max_entries_] = {
+        .offset = (uint32_t)start,
+        .length = (uint16_t)length,
+        .role = role,
+    };
+    count_++;
+    head_ = start + needed;
+}
+
+void ChatHistory::ExtendLast(const char* text) {
+    if (count_ == 0) {
+        return;
+    }
+    auto& last = entries_[(first_ + count_ - 1) % max_entries_];
+    size_t length = LimitLength(text, last.length);
+    if (length == 0) {
+        return;
+    }
+
+    // Overwrite the terminating NUL of the newest message
+    size_t start = last.offset + last.length;
+    if (start + length + 1 > capacity_) {
+        // No room at the tail, store the whole message again from the front
+        std::string combined(buffer_ + last.offset, last.length);
+        combined.append(text, length);
+        uint8_t role = last.role;
+        RemoveLast();
+        Append(role, combined.c_str());
+        return;
+    }
+    // Once the buffer wrapped, the oldest messages follow the newest one
+    while (count_ > 1) {
+        auto& oldest = entry(0);
+        if (oldest.offset > last.offset && oldest.offset < start + length + 1) {
+            PopFront();
+        } else {
+            break;
+        }
+    }
+
+    memcpy(buffer_ + start, text, length);
+    buffer_[start + length] = '\0';
+    last.length += length;
+    head_ = start + length + 1;
+}
+
+void ChatHistory::RemoveLast() {
+    if (count_ == 0) {
+        return;
+    }
+    head_ = entry(count_ - 1).offset;
+    count_--;
+    if (count_ == 0) {
+        first_ = 0;
+        head_ = 0;
+    }
+}
+
+void ChatHistory::Clear() {
+    first_ = 0;
+    count_ = 0;
+    head_ = 0;
+}
+
+uint8_t ChatHistory::role(size_t index) const {
+    return entry(index).role;
+}
+
+const char* ChatHistory::text(size_t index) const {
+    return buffer_ + entry(index).offset;
+}
@@ -0,0 +1,50 @@
+#ifndef CHAT_HISTORY_H
+#define CHAT_HISTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Compact ring buffer of chat messages for the WeChat style UI.
+// Texts are stored NUL terminated in one preallocated block, so only the
+// visible bubbles need LVGL objects and the history never allocates per message.
+// The oldest messages are evicted when the block or the entry table is full.
+class ChatHistory {
+public:
+    ChatHistory(size_t capacity, size_t max_entries);
+    ~ChatHistory();
+
+    void Append(uint8_t role, const char* text);
+    // Add streamed text to the newest message, in place when the buffer allows
+    void ExtendLast(const char* text);
+    void RemoveLast();
+    void Clear();
+
+    // index 0 is the oldest message
+    inline size_t size() const { return count_; }
+    uint8_t role(size_t index) const;
+    const char* text(size_t index) const;
+
+private:
+    struct Entry {
+        uint32_t offset;
+        uint16_t length;
+        uint8_t role;
+    };
+
+    char* buffer_ = nullptr;
+    size_t capacity_;
+    Entry* entries_ = nullptr;
+    size_t max_entries_;
+    size_t first_ = 0;
+    size_t count_ = 0;
+    size_t head_ = 0;
+
+    inline const Entry& entry(size_t index) const {
+        return entries_[(first_ + index) % max_entries_];
+    }
+    void PopFront();
+    size_t LimitLength(const char* text, size_t used) const;
+};
+
+#endif // CHAT_HISTORY_H
@@ -1,8 +1,10 @@
 #include <esp_log.h>
 #include <esp_err.h>
+#include <esp_heap_caps.h>
 #include <string>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 
 #include "display.h"
 #include "board.h"
@@ -11,6 +13,7 @@
 #include "audio_codec.h"
 #include "settings.h"
 #include "assets/lang_config.h"
+#include "system_info.h"
 
 #define TAG "Display"
 
@@ -19,9 +22,7 @@ Display::Display() {
     esp_timer_create_args_t notification_timer_args = {
         .callback = [](void *arg) {
             Display *display = static_cast<Display*>(arg);
-            DisplayLockGuard lock(display);
-            lv_obj_add_flag(display->notification_label_, LV_OBJ_FLAG_HIDDEN);
-            lv_obj_clear_flag(display->status_label_, LV_OBJ_FLAG_HIDDEN);
+            display->HideNotification();
         },
         .arg = this,
         .dispatch_method = ESP_TIMER_TASK,
@@ -44,6 +45,11 @@ Display::~Display() {
         esp_timer_stop(notification_timer_);
         esp_timer_delete(notification_timer_);
     }
+    // Enqueue paths check command_timer_ without the command mutex, clear it before the timer goes
+    auto command_timer = command_timer_.exchange(nullptr);
+    if (command_timer != nullptr) {
+        lv_timer_delete(command_timer);
+    }
 
     if (network_label_ != nullptr) {
         lv_obj_del(network_label_);
@@ -61,7 +67,147 @@ Display::~Display() {
     }
 }
 
+bool DisplayCommands::empty() const {
+    return status_seq == 0 && notification_seq == 0 && notification_hide_seq == 0 && !emotion_pending &&
+        chat_messages.empty() && mute_icon == nullptr && battery_icon == nullptr && network_icon == nullptr &&
+        low_battery_popup < 0;
+}
+
+void DisplayCommands::clear() {
+    status_seq = 0;
+    status.clear();
+    notification_seq = 0;
+    notification.clear();
+    notification_hide_seq = 0;
+    emotion_pending = false;
+    emotion.clear();
+    chat_messages.clear();
+    mute_icon = nullptr;
+    battery_icon = nullptr;
+    network_icon = nullptr;
+    low_battery_popup = -1;
+}
+
+void DisplayCommands::swap(DisplayCommands& other) {
+    std::swap(status_seq, other.status_seq);
+    status.swap(other.status);
+    std::swap(notification_seq, other.notification_seq);
+    notification.swap(other.notification);
+    std::swap(notification_hide_seq, other.notification_hide_seq);
+    std::swap(emotion_pending, other.emotion_pending);
+    std::swap(emotion_is_icon, other.emotion_is_icon);
+    emotion.swap(other.emotion);
+    chat_messages.swap(other.chat_messages);
+    std::swap(mute_icon, other.mute_icon);
+    std::swap(battery_icon, other.battery_icon);
+    std::swap(network_icon, other.network_icon);
+    std::swap(low_battery_popup, other.low_battery_popup);
+}
+
+void Display::StartCommandQueue() {
+    if (command_timer_ != nullptr) {
+        return;
+    }
+    command_timer_ = lv_timer_create([](lv_timer_t* timer) {
+        auto display = static_cast<Display*>(lv_timer_get_user_data(timer));
+        display->ProcessCommands();
+    }, DISPLAY_COMMAND_PERIOD_MS, this);
+}
+
+void Display::ProcessCommands() {
+    {
+        std::lock_guard<std::mutex> lock(command_mutex_);
+        if (pending_commands_.empty()) {
+            return;
+        }
+        // Keep both buffers so the strings and the deque reuse their memory
+        pending_commands_.swap(drain_commands_);
+    }
+
+    auto start_time = esp_timer_get_time();
+    auto& commands = drain_commands_;
+
+    // Status and notification share the status line, apply them in the order they came
+    struct StatusLineCommand {
+        uint32_t seq;
+        int type;
+    } status_line[] = {
+        {commands.status_seq, 0},
+        {commands.notification_seq, 1},
+        {commands.notification_hide_seq, 2},
+    };
+    std::sort(std::begin(status_line), std::end(status_line), [](const StatusLineCommand& a, const StatusLineCommand& b) {
+        return a.seq < b.seq;
+    });
+    for (auto& command : status_line) {
+        if (command.seq == 0) {
+            continue;
+        }
+        if (command.type == 0) {
+            SetStatusImpl(commands.status.c_str());
+        } else if (command.type == 1) {
+            ShowNotificationImpl(commands.notification.c_str());
+        } else {
+            HideNotificationImpl();
+        }
+    }
+
+    if (commands.emotion_pending) {
+        if (commands.emotion_is_icon) {
+            SetIconImpl(commands.emotion.c_str());
+        } else {
+            SetEmotionImpl(commands.emotion.c_str());
+        }
+    }
+    for (auto& message : commands.chat_messages) {
+        if (message.append) {
+            AppendChatMessageImpl(message.role.c_str(), message.content.c_str());
+        } else {
+            SetChatMessageImpl(message.role.c_str(), message.content.c_str());
+        }
+    }
+    if (commands.mute_icon != nullptr || commands.battery_icon != nullptr || commands.network_icon != nullptr ||
+        commands.low_battery_popup >= 0) {
+        UpdateStatusBarImpl(commands.mute_icon, commands.battery_icon, commands.network_icon, commands.low_battery_popup);
+    }
+    commands.clear();
+
+    auto drain_time = esp_timer_get_time() - start_time;
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    if (drain_time > max_drain_time_us_) {
+        max_drain_time_us_ = drain_time;
+    }
+}
+
+void Display::PrintCommandStats() {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    if (enqueued_commands_ == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Commands: %u enqueued, %u coalesced, %u dropped, max chat depth %u, max drain %ld us",
+        enqueued_commands_, coalesced_commands_, dropped_commands_, max_pending_chat_messages_, (long)max_drain_time_us_);
+    enqueued_commands_ = 0;
+    coalesced_commands_ = 0;
+    dropped_commands_ = 0;
+    max_pending_chat_messages_ = 0;
+    max_drain_time_us_ = 0;
+}
+
 void Display::SetStatus(const char* status) {
+    if (command_timer_ == nullptr) {
+        SetStatusImpl(status);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    enqueued_commands_++;
+    if (pending_commands_.status_seq != 0) {
+        coalesced_commands_++;
+    }
+    pending_commands_.status = status;
+    pending_commands_.status_seq = ++command_seq_;
+}
+
+void Display::SetStatusImpl(const char* status) {
     DisplayLockGuard lock(this);
     if (status_label_ == nullptr) {
         return;
@@ -76,6 +222,23 @@ void Display::ShowNotification(const std::string &notification, int duration_ms)
 }
 
 void Display::ShowNotification(const char* notification, int duration_ms) {
+    if (command_timer_ == nullptr) {
+        ShowNotificationImpl(notification);
+    } else {
+        std::lock_guard<std::mutex> lock(command_mutex_);
+        enqueued_commands_++;
+        if (pending_commands_.notification_seq != 0) {
+            coalesced_commands_++;
+        }
+        pending_commands_.notification = notification;
+        pending_commands_.notification_seq = ++command_seq_;
+    }
+
+    esp_timer_stop(notification_timer_);
+    ESP_ERROR_CHECK(esp_timer_start_once(notification_timer_, duration_ms * 1000));
+}
+
+void Display::ShowNotificationImpl(const char* notification) {
     DisplayLockGuard lock(this);
     if (notification_label_ == nullptr) {
         return;
@@ -83,29 +246,48 @@ void Display::ShowNotification(const char* notification, int duration_ms) {
     lv_label_set_text(notification_label_, notification);
     lv_obj_clear_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
     lv_obj_add_flag(status_label_, LV_OBJ_FLAG_HIDDEN);
+}
 
-    esp_timer_stop(notification_timer_);
-    ESP_ERROR_CHECK(esp_timer_start_once(notification_timer_, duration_ms * 1000));
+void Display::HideNotification() {
+    if (command_timer_ == nullptr) {
+        HideNotificationImpl();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    enqueued_commands_++;
+    pending_commands_.notification_hide_seq = ++command_seq_;
+}
+
+void Display::HideNotificationImpl() {
+    DisplayLockGuard lock(this);
+    if (notification_label_ == nullptr) {
+        return;
+    }
+    lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_clear_flag(status_label_, LV_OBJ_FLAG_HIDDEN);
 }
 
-void Display::UpdateStatusBar(bool update_all) {
+void Display::UpdateStatusBar(int fields) {
     auto& board = Board::GetInstance();
     auto codec = board.GetAudioCodec();
+    if (mute_label_ == nullptr) {
+        return;
+    }
+    std::unique_lock<std::mutex> status_bar_lock(status_bar_mutex_);
 
-    {
-        DisplayLockGuard lock(this);
-        if (mute_label_ == nullptr) {
-            return;
-        }
+    // Only the icons that changed are sent to the LVGL task
+    const char* mute_icon = nullptr;
+    const char* battery_icon = nullptr;
+    const char* network_icon = nullptr;
+    int low_battery_popup = -1;
 
-        // 如果静音状态改变，则更新图标
-        if (codec->output_volume() == 0 && !muted_) {
-            muted_ = true;
-            lv_label_set_text(mute_label_, FONT_AWESOME_VOLUME_MUTE);
-        } else if (codec->output_volume() > 0 && muted_) {
-            muted_ = false;
-            lv_label_set_text(mute_label_, "");
-        }
+    // 如果静音状态改变，则更新图标
+    if ((fields & kStatusBarMute) && codec->output_volume() == 0 && !muted_) {
+        muted_ = true;
+        mute_icon = FONT_AWESOME_VOLUME_MUTE;
+    } else if ((fields & kStatusBarMute) && codec->output_volume() > 0 && muted_) {
+        muted_ = false;
+        mute_icon = "";
     }
 
     esp_pm_lock_acquire(pm_lock_);
@@ -113,7 +295,7 @@ void Display::UpdateStatusBar(bool update_all) {
     int battery_level;
     bool charging, discharging;
     const char* icon = nullptr;
-    if (board.GetBatteryLevel(battery_level, charging, discharging)) {
+    if ((fields & kStatusBarBattery) && board.GetBatteryLevel(battery_level, charging, discharging)) {
         if (charging) {
             icon = FONT_AWESOME_BATTERY_CHARGING;
         } else {
@@ -127,31 +309,21 @@ void Display::UpdateStatusBar(bool update_all) {
             };
             icon = levels[battery_level / 20];
         }
-        DisplayLockGuard lock(this);
         if (battery_label_ != nullptr && battery_icon_ != icon) {
             battery_icon_ = icon;
-            lv_label_set_text(battery_label_, battery_icon_);
+            battery_icon = icon;
         }
 
         if (low_battery_popup_ != nullptr) {
-            if (strcmp(icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging) {
-                if (lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // 如果低电量提示框隐藏，则显示
-                    lv_obj_clear_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                    auto& app = Application::GetInstance();
-                    app.PlaySound(Lang::Sounds::P3_LOW_BATTERY);
-                }
-            } else {
-                // Hide the low battery popup when the battery is not empty
-                if (!lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // 如果低电量提示框显示，则隐藏
-                    lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                }
+            bool low_battery = strcmp(icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging;
+            if (low_battery != low_battery_shown_) {
+                low_battery_shown_ = low_battery;
+                low_battery_popup = low_battery ? 1 : 0;
             }
         }
     }
 
-    // 每 10 秒更新一次网络图标
-    static int seconds_counter = 0;
-    if (update_all || seconds_counter++ % 10 == 0) {
+    if (fields & kStatusBarNetwork) {
         // 升级固件时，不读取 4G 网络状态，避免占用 UART 资源
         auto device_state = Application::GetInstance().GetDeviceState();
         static const std::vector<DeviceState> allowed_states = {
@@ -164,18 +336,84 @@ void Display::UpdateStatusBar(bool update_all) {
         if (std::find(allowed_states.begin(), allowed_states.end(), device_state) != allowed_states.end()) {
             icon = board.GetNetworkStateIcon();
             if (network_label_ != nullptr && icon != nullptr && network_icon_ != icon) {
-                DisplayLockGuard lock(this);
                 network_icon_ = icon;
-                lv_label_set_text(network_label_, network_icon_);
+                network_icon = icon;
             }
         }
     }
 
     esp_pm_lock_release(pm_lock_);
+    status_bar_lock.unlock();
+
+    // 显示低电量提示框时播放提示音，放在锁外，播放可能阻塞在音频通路上
+    if (low_battery_popup == 1) {
+        Application::GetInstance().PlaySound(Lang::Sounds::P3_LOW_BATTERY);
+    }
+
+    if (mute_icon == nullptr && battery_icon == nullptr && network_icon == nullptr && low_battery_popup < 0) {
+        return;
+    }
+    if (command_timer_ == nullptr) {
+        UpdateStatusBarImpl(mute_icon, battery_icon, network_icon, low_battery_popup);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    enqueued_commands_++;
+    auto& pending = pending_commands_;
+    if (pending.mute_icon != nullptr || pending.battery_icon != nullptr || pending.network_icon != nullptr ||
+        pending.low_battery_popup >= 0) {
+        coalesced_commands_++;
+    }
+    if (mute_icon != nullptr) {
+        pending.mute_icon = mute_icon;
+    }
+    if (battery_icon != nullptr) {
+        pending.battery_icon = battery_icon;
+    }
+    if (network_icon != nullptr) {
+        pending.network_icon = network_icon;
+    }
+    if (low_battery_popup >= 0) {
+        pending.low_battery_popup = low_battery_popup;
+    }
 }
 
+void Display::UpdateStatusBarImpl(const char* mute_icon, const char* battery_icon, const char* network_icon, int low_battery_popup) {
+    DisplayLockGuard lock(this);
+    if (mute_icon != nullptr && mute_label_ != nullptr) {
+        lv_label_set_text(mute_label_, mute_icon);
+    }
+    if (battery_icon != nullptr && battery_label_ != nullptr) {
+        lv_label_set_text(battery_label_, battery_icon);
+    }
+    if (network_icon != nullptr && network_label_ != nullptr) {
+        lv_label_set_text(network_label_, network_icon);
+    }
+    if (low_battery_popup >= 0 && low_battery_popup_ != nullptr) {
+        if (low_battery_popup) {
+            lv_obj_clear_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+        } else {
+            lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+}
 
 void Display::SetEmotion(const char* emotion) {
+    if (command_timer_ == nullptr) {
+        SetEmotionImpl(emotion);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    enqueued_commands_++;
+    if (pending_commands_.emotion_pending) {
+        coalesced_commands_++;
+    }
+    pending_commands_.emotion = emotion;
+    pending_commands_.emotion_is_icon = false;
+    pending_commands_.emotion_pending = true;
+}
+
+void Display::SetEmotionImpl(const char* emotion) {
     struct Emotion {
         const char* icon;
         const char* text;
@@ -224,6 +462,22 @@ void Display::SetEmotion(const char* emotion) {
 }
 
 void Display::SetIcon(const char* icon) {
+    if (command_timer_ == nullptr) {
+        SetIconImpl(icon);
+        return;
+    }
+    // The icon and the emotion share one label, the latest one wins
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    enqueued_commands_++;
+    if (pending_commands_.emotion_pending) {
+        coalesced_commands_++;
+    }
+    pending_commands_.emotion = icon;
+    pending_commands_.emotion_is_icon = true;
+    pending_commands_.emotion_pending = true;
+}
+
+void Display::SetIconImpl(const char* icon) {
     DisplayLockGuard lock(this);
     if (emotion_label_ == nullptr) {
         return;
@@ -231,11 +485,82 @@ void Display::SetIcon(const char* icon) {
     lv_label_set_text(emotion_label_, icon);
 }
 
-void Display::SetPreviewImage(const lv_img_dsc_t* image) {
+void Display::SetPreviewImage(std::unique_ptr<PreviewImage> image) {
     // Do nothing
 }
 
+PreviewImage::PreviewImage(uint32_t width, uint32_t height) {
+    uint32_t data_size = width * height * 2;
+    void* data = heap_caps_malloc(data_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == nullptr) {
+        // Fallback to internal RAM if SPIRAM allocation fails
+        data = heap_caps_malloc(data_size, MALLOC_CAP_8BIT);
+    }
+    if (data == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate preview image (%lu bytes)", data_size);
+        return;
+    }
+    image.header.magic = LV_IMAGE_HEADER_MAGIC;
+    image.header.cf = LV_COLOR_FORMAT_RGB565;
+    image.header.w = width;
+    image.header.h = height;
+    image.header.stride = width * 2;
+    image.data_size = data_size;
+    image.data = (const uint8_t*)data;
+}
+
+PreviewImage::~PreviewImage() {
+    if (image.data != nullptr) {
+        heap_caps_free((void*)image.data);
+    }
+}
+
 void Display::SetChatMessage(const char* role, const char* content) {
+    if (command_timer_ == nullptr) {
+        SetChatMessageImpl(role, content);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    enqueued_commands_++;
+    auto& messages = pending_commands_.chat_messages;
+    // Consecutive system messages replace each other on every display
+    if (!messages.empty() && content[0] != '\0' && strcmp(role, "system") == 0 &&
+        messages.back().role == "system" && !messages.back().content.empty() && !messages.back().append) {
+        messages.back().content = content;
+        coalesced_commands_++;
+        return;
+    }
+    if (messages.size() >= DISPLAY_MAX_PENDING_CHAT_MESSAGES) {
+        messages.pop_front();
+        dropped_commands_++;
+    }
+    messages.push_back({role, content});
+    max_pending_chat_messages_ = std::max(max_pending_chat_messages_, messages.size());
+}
+
+void Display::AppendChatMessage(const char* role, const char* delta) {
+    if (command_timer_ == nullptr) {
+        AppendChatMessageImpl(role, delta);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    enqueued_commands_++;
+    auto& messages = pending_commands_.chat_messages;
+    // Text streamed within one frame extends the pending message, so it is laid out once
+    if (!messages.empty() && messages.back().role == role && !messages.back().content.empty()) {
+        messages.back().content += delta;
+        coalesced_commands_++;
+        return;
+    }
+    if (messages.size() >= DISPLAY_MAX_PENDING_CHAT_MESSAGES) {
+        messages.pop_front();
+        dropped_commands_++;
+    }
+    messages.push_back({role, delta, true});
+    max_pending_chat_messages_ = std::max(max_pending_chat_messages_, messages.size());
+}
+
+void Display::SetChatMessageImpl(const char* role, const char* content) {
     DisplayLockGuard lock(this);
     if (chat_message_label_ == nullptr) {
         return;
@@ -243,8 +568,161 @@ void Display::SetChatMessage(const char* role, const char* content) {
     lv_label_set_text(chat_message_label_, content);
 }
 
+void Display::AppendChatMessageImpl(const char* role, const char* delta) {
+    DisplayLockGuard lock(this);
+    if (chat_message_label_ == nullptr) {
+        return;
+    }
+    lv_label_ins_text(chat_message_label_, LV_LABEL_POS_LAST, delta);
+}
+
 void Display::SetTheme(const std::string& theme_name) {
     current_theme_name_ = theme_name;
     Settings settings("display", true);
     settings.SetString("theme", theme_name);
 }
+
+#if CONFIG_USE_DISPLAY_BENCHMARK
+void Display::StartBenchmark() {
+    // Called from SetupUI with the display locked
+    lv_display_add_event_cb(display_, [](lv_event_t* e) {
+        auto display = static_cast<Display*>(lv_event_get_user_data(e));
+        auto& stats = display->benchmark_stats_;
+        auto now = esp_timer_get_time();
+        switch (lv_event_get_code(e)) {
+        case LV_EVENT_INVALIDATE_AREA: {
+            auto area = static_cast<const lv_area_t*>(lv_event_get_param(e));
+            stats.invalidated_pixels += lv_area_get_size(area);
+            break;
+        }
+        case LV_EVENT_RENDER_START:
+            stats.render_start_time = now;
+            break;
+        case LV_EVENT_RENDER_READY: {
+            // Includes the flushes of every area in partial mode
+            auto render_us = now - stats.render_start_time;
+            stats.frames++;
+            stats.render_us += render_us;
+            stats.max_render_us = std::max(stats.max_render_us, render_us);
+            break;
+        }
+        case LV_EVENT_FLUSH_WAIT_START:
+            stats.flush_wait_start_time = now;
+            break;
+        case LV_EVENT_FLUSH_WAIT_FINISH:
+            stats.flush_wait_us += now - stats.flush_wait_start_time;
+            break;
+        default:
+            break;
+        }
+    }, LV_EVENT_ALL, this);
+
+    xTaskCreate([](void* arg) {
+        auto display = static_cast<Display*>(arg);
+        display->RunBenchmark();
+        vTaskDelete(NULL);
+    }, "display_benchmark", 4096, this, 1, nullptr);
+}
+
+// Calls the render hooks directly so the time is the layout cost of the update, not the queueing
+void Display::TimeBenchmarkCall(BenchmarkCall call, std::function<void()> callback) {
+    DisplayLockGuard lock(this);
+    auto start_time = esp_timer_get_time();
+    callback();
+    auto call_us = esp_timer_get_time() - start_time;
+    benchmark_stats_.calls[call]++;
+    benchmark_stats_.call_us[call] += call_us;
+    benchmark_stats_.max_call_us[call] = std::max(benchmark_stats_.max_call_us[call], call_us);
+}
+
+void Display::RunBenchmark() {
+    static const char* messages[] = {
+        "The quick brown fox jumps over the lazy dog, then keeps running across the whole screen to force a wrap.",
+        "今天天气不错，我们一起去公园散步吧。顺便聊聊最近看的书和电影，好吗？",
+        "OK",
+        "这是一条很长的中文消息，用来测试自动换行、滚动和气泡复用时的渲染耗时，以及刷新到屏幕所需要的时间。",
+    };
+    static const char* emotions[] = {"happy", "thinking", "laughing", "sad", "surprised", "cool", "sleepy"};
+    static const char* statuses[] = {Lang::Strings::LISTENING, Lang::Strings::SPEAKING, Lang::Strings::STANDBY};
+    static const char* sentences[] = {"Streaming keeps the bubble growing.", "接下来的句子追加到同一个气泡里。"};
+    static const char* call_names[] = {"chat message", "append chat message", "emotion", "status", "notification", "theme"};
+
+    // Let the startup screens settle before measuring
+    vTaskDelay(pdMS_TO_TICKS(3000));
+    {
+        DisplayLockGuard lock(this);
+        benchmark_stats_ = BenchmarkStats();
+    }
+
+    ESP_LOGI(TAG, "Display benchmark started, %d seconds", CONFIG_DISPLAY_BENCHMARK_SECONDS);
+    std::string original_theme = GetTheme();
+    auto start_free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t min_free_heap = start_free_heap;
+    auto start_time = esp_timer_get_time();
+    auto end_time = start_time + CONFIG_DISPLAY_BENCHMARK_SECONDS * 1000000LL;
+    for (int i = 0; esp_timer_get_time() < end_time; i++) {
+        TimeBenchmarkCall(kBenchmarkChatMessage, [this, i]() {
+            SetChatMessageImpl(i % 2 == 0 ? "user" : "assistant", messages[i % (sizeof(messages) / sizeof(messages[0]))]);
+        });
+        // Assistant answers stream a few more sentences into the same message
+        for (int j = 0; i % 2 == 1 && j < 3; j++) {
+            TimeBenchmarkCall(kBenchmarkAppendChatMessage, [this, j]() {
+                AppendChatMessageImpl("assistant", sentences[j % (sizeof(sentences) / sizeof(sentences[0]))]);
+            });
+        }
+        TimeBenchmarkCall(kBenchmarkEmotion, [this, i]() {
+            SetEmotionImpl(emotions[i % (sizeof(emotions) / sizeof(emotions[0]))]);
+        });
+        if (i % 5 == 0) {
+            TimeBenchmarkCall(kBenchmarkStatus, [this, i]() {
+                SetStatusImpl(statuses[(i / 5) % (sizeof(statuses) / sizeof(statuses[0]))]);
+            });
+        } else if (i % 5 == 2) {
+            TimeBenchmarkCall(kBenchmarkNotification, [this]() {
+                ShowNotificationImpl(Lang::Strings::CONNECTING);
+            });
+        } else if (i % 5 == 4) {
+            TimeBenchmarkCall(kBenchmarkNotification, [this]() {
+                HideNotificationImpl();
+            });
+        }
+        // Theme switches are saved to NVS, keep them rare
+        if (!original_theme.empty() && i % 30 == 29) {
+            TimeBenchmarkCall(kBenchmarkTheme, [this, i]() {
+                SetTheme(i % 60 == 29 ? "dark" : "light");
+            });
+        }
+        min_free_heap = std::min(min_free_heap, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    if (!original_theme.empty() && GetTheme() != original_theme) {
+        SetTheme(original_theme);
+    }
+
+    BenchmarkStats stats;
+    {
+        DisplayLockGuard lock(this);
+        stats = benchmark_stats_;
+    }
+    auto elapsed_us = esp_timer_get_time() - start_time;
+    for (int i = 0; i < kBenchmarkCallCount; i++) {
+        if (stats.calls[i] > 0) {
+            ESP_LOGI(TAG, "Display benchmark: %s x%lu, avg %ld us, max %ld us", call_names[i], stats.calls[i],
+                (long)(stats.call_us[i] / stats.calls[i]), (long)stats.max_call_us[i]);
+        }
+    }
+    // LVGL allocates from the system heap (CLIB malloc), so the heap low-water covers it
+    ESP_LOGI(TAG, "Display benchmark: heap low-water %u bytes below start, end delta %ld bytes",
+        start_free_heap - min_free_heap, (long)start_free_heap - (long)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    if (stats.frames == 0) {
+        ESP_LOGW(TAG, "Display benchmark: no frames rendered");
+        return;
+    }
+    ESP_LOGI(TAG, "Display benchmark: %lu frames in %ld ms, %.1f fps", stats.frames, (long)(elapsed_us / 1000),
+        stats.frames * 1000000.0f / elapsed_us);
+    ESP_LOGI(TAG, "Display benchmark: render+flush avg %ld us max %ld us, flush wait avg %ld us, %llu px/frame, lvgl busy %.1f%%",
+        (long)(stats.render_us / stats.frames), (long)stats.max_render_us, (long)(stats.flush_wait_us / stats.frames),
+        stats.invalidated_pixels / stats.frames, stats.render_us * 100.0f / elapsed_us);
+    SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
+}
+#endif
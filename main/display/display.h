@@ -7,6 +7,14 @@
 #include <esp_pm.h>
 
 #include <string>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#define DISPLAY_COMMAND_PERIOD_MS 30
+#define DISPLAY_MAX_PENDING_CHAT_MESSAGES 16
 
 struct DisplayFonts {
     const lv_font_t* text_font = nullptr;
@@ -14,21 +22,74 @@ struct DisplayFonts {
     const lv_font_t* emoji_font = nullptr;
 };
 
+// An RGB565 preview handed over to the display, which shows it without a copy and frees it
+struct PreviewImage {
+    lv_img_dsc_t image = {};
+
+    PreviewImage(uint32_t width, uint32_t height);
+    ~PreviewImage();
+    PreviewImage(const PreviewImage&) = delete;
+    PreviewImage& operator=(const PreviewImage&) = delete;
+};
+
+// Status bar fields to refresh, each one is updated when its source reports a change
+enum StatusBarField {
+    kStatusBarMute = 1 << 0,
+    kStatusBarBattery = 1 << 1,
+    kStatusBarNetwork = 1 << 2,
+    kStatusBarAll = kStatusBarMute | kStatusBarBattery | kStatusBarNetwork,
+};
+
+struct ChatMessageCommand {
+    std::string role;
+    std::string content;
+    bool append = false;    // extend the latest message instead of adding one
+};
+
+// Display updates waiting for the LVGL task, repeated updates of the same widget are merged
+struct DisplayCommands {
+    uint32_t status_seq = 0;
+    std::string status;
+    uint32_t notification_seq = 0;
+    std::string notification;
+    uint32_t notification_hide_seq = 0;
+    bool emotion_pending = false;
+    bool emotion_is_icon = false;
+    std::string emotion;
+    std::deque<ChatMessageCommand> chat_messages;
+    // Status bar, nullptr / -1 means unchanged
+    const char* mute_icon = nullptr;
+    const char* battery_icon = nullptr;
+    const char* network_icon = nullptr;
+    int8_t low_battery_popup = -1;
+
+    bool empty() const;
+    void clear();
+    void swap(DisplayCommands& other);
+};
+
 class Display {
 public:
     Display();
     virtual ~Display();
 
-    virtual void SetStatus(const char* status);
-    virtual void ShowNotification(const char* notification, int duration_ms = 3000);
-    virtual void ShowNotification(const std::string &notification, int duration_ms = 3000);
-    virtual void SetEmotion(const char* emotion);
-    virtual void SetChatMessage(const char* role, const char* content);
-    virtual void SetIcon(const char* icon);
-    virtual void SetPreviewImage(const lv_img_dsc_t* image);
+    // These never block on rendering, the LVGL task applies them on its next frame
+    void SetStatus(const char* status);
+    void ShowNotification(const char* notification, int duration_ms = 3000);
+    void ShowNotification(const std::string &notification, int duration_ms = 3000);
+    void SetEmotion(const char* emotion);
+    void SetChatMessage(const char* role, const char* content);
+    // Extend the latest message with streamed text, a message of another role starts a new one
+    void AppendChatMessage(const char* role, const char* delta);
+    void SetIcon(const char* icon);
+    // Safe to call from any task (not from an ISR), only changed icons are redrawn
+    void UpdateStatusBar(int fields = kStatusBarAll);
+
+    // nullptr hides the preview
+    virtual void SetPreviewImage(std::unique_ptr<PreviewImage> image);
     virtual void SetTheme(const std::string& theme_name);
     virtual std::string GetTheme() { return current_theme_name_; }
-    virtual void UpdateStatusBar(bool update_all = false);
+    void PrintCommandStats();
 
     inline int width() const { return width_; }
     inline int height() const { return height_; }
@@ -57,9 +118,73 @@ protected:
 
     esp_timer_handle_t notification_timer_ = nullptr;
 
+    // Render the updates, called by the LVGL task (or the caller before StartCommandQueue)
+    virtual void SetStatusImpl(const char* status);
+    virtual void ShowNotificationImpl(const char* notification);
+    virtual void HideNotificationImpl();
+    virtual void SetEmotionImpl(const char* emotion);
+    virtual void SetChatMessageImpl(const char* role, const char* content);
+    virtual void AppendChatMessageImpl(const char* role, const char* delta);
+    virtual void SetIconImpl(const char* icon);
+    virtual void UpdateStatusBarImpl(const char* mute_icon, const char* battery_icon, const char* network_icon, int low_battery_popup);
+
+    // Call with the display locked once LVGL is set up
+    void StartCommandQueue();
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    void StartBenchmark();
+#endif
+
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
     virtual void Unlock() = 0;
+
+private:
+    std::mutex command_mutex_;
+    // Read without the command mutex by every enqueue path
+    std::atomic<lv_timer_t*> command_timer_ = nullptr;
+    uint32_t command_seq_ = 0;
+    DisplayCommands pending_commands_;
+    DisplayCommands drain_commands_;
+    bool low_battery_shown_ = false;
+    // Status bar events come from several tasks
+    std::mutex status_bar_mutex_;
+
+    size_t enqueued_commands_ = 0;
+    size_t coalesced_commands_ = 0;
+    size_t dropped_commands_ = 0;
+    size_t max_pending_chat_messages_ = 0;
+    int64_t max_drain_time_us_ = 0;
+
+    void HideNotification();
+    void ProcessCommands();
+
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    enum BenchmarkCall {
+        kBenchmarkChatMessage,
+        kBenchmarkAppendChatMessage,
+        kBenchmarkEmotion,
+        kBenchmarkStatus,
+        kBenchmarkNotification,
+        kBenchmarkTheme,
+        kBenchmarkCallCount
+    };
+    struct BenchmarkStats {
+        int64_t render_start_time = 0;
+        int64_t flush_wait_start_time = 0;
+        uint32_t frames = 0;
+        int64_t render_us = 0;
+        int64_t flush_wait_us = 0;
+        int64_t max_render_us = 0;
+        uint64_t invalidated_pixels = 0;
+        uint32_t calls[kBenchmarkCallCount] = {};
+        int64_t call_us[kBenchmarkCallCount] = {};
+        int64_t max_call_us[kBenchmarkCallCount] = {};
+    };
+    BenchmarkStats benchmark_stats_;
+
+    void RunBenchmark();
+    void TimeBenchmarkCall(BenchmarkCall call, std::function<void()> callback);
+#endif
 };
 
 
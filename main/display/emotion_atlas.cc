@@ -0,0 +1,134 @@
+#include "emotion_atlas.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "EmotionAtlas"
+
+EmotionAtlas::~EmotionAtlas() {
+    Clear();
+}
+
+void EmotionAtlas::Clear() {
+    for (auto& entry : entries_) {
+        for (auto frame : entry.frames) {
+            heap_caps_free(frame->data);
+            delete frame;
+        }
+    }
+    entries_.clear();
+    bytes_ = 0;
+}
+
+EmotionAtlas::Entry& EmotionAtlas::GetEntry(const char* name) {
+    for (auto& entry : entries_) {
+        if (entry.name == name) {
+            return entry;
+        }
+    }
+    entries_.push_back({.name = name});
+    return entries_.back();
+}
+
+const EmotionAtlas::Entry* EmotionAtlas::Find(const char* name) const {
+    for (auto& entry : entries_) {
+        if (entry.name == name) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+lv_draw_buf_t* EmotionAtlas::CreateBuffer(uint32_t width, uint32_t height, lv_color_format_t cf, uint32_t stride) {
+    uint32_t size = stride * height;
+    void* data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %lu bytes for emotion image", size);
+        return nullptr;
+    }
+    auto buffer = new lv_draw_buf_t();
+    if (lv_draw_buf_init(buffer, width, height, cf, stride, data, size) != LV_RESULT_OK) {
+        heap_caps_free(data);
+        delete buffer;
+        return nullptr;
+    }
+    bytes_ += size;
+    return buffer;
+}
+
+bool EmotionAtlas::RenderGlyph(const char* name, const char* glyph, const lv_font_t* font, lv_color_t color) {
+    int32_t width = lv_text_get_width(glyph, strlen(glyph), font, 0);
+    int32_t height = lv_font_get_line_height(font);
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    // Keep alpha so the image blends over any theme background
+    auto cf = LV_COLOR_FORMAT_ARGB8888;
+    auto buffer = CreateBuffer(width, height, cf, lv_draw_buf_width_to_stride(width, cf));
+    if (buffer == nullptr) {
+        return false;
+    }
+    DrawGlyph(buffer, glyph, font, color);
+
+    auto& entry = GetEntry(name);
+    entry.frames.push_back(buffer);
+    entry.glyph = glyph;
+    entry.font = font;
+    return true;
+}
+
+void EmotionAtlas::RecolorGlyphs(lv_color_t color) {
+    for (auto& entry : entries_) {
+        if (entry.glyph == nullptr || entry.frames.empty()) {
+            continue;
+        }
+        DrawGlyph(entry.frames[0], entry.glyph, entry.font, color);
+        // The buffer is the image source itself, drop anything LVGL cached for it
+        lv_image_cache_drop(entry.frames[0]);
+    }
+}
+
+void EmotionAtlas::DrawGlyph(lv_draw_buf_t* buffer, const char* glyph, const lv_font_t* font, lv_color_t color) {
+    memset(buffer->data, 0, buffer->data_size);
+
+    // A hidden canvas is only used as the render target
+    auto canvas = lv_canvas_create(lv_layer_top());
+    lv_obj_add_flag(canvas, LV_OBJ_FLAG_HIDDEN);
+    lv_canvas_set_draw_buf(canvas, buffer);
+
+    lv_layer_t layer;
+    lv_canvas_init_layer(canvas, &layer);
+    lv_draw_label_dsc_t label_dsc;
+    lv_draw_label_dsc_init(&label_dsc);
+    label_dsc.font = font;
+    label_dsc.color = color;
+    label_dsc.text = glyph;
+    lv_area_t area = {0, 0, (int32_t)buffer->header.w - 1, (int32_t)buffer->header.h - 1};
+    lv_draw_label(&layer, &label_dsc, &area);
+    lv_canvas_finish_layer(canvas, &layer);
+    lv_obj_del(canvas);
+}
+
+bool EmotionAtlas::AddFrame(const char* name, const lv_image_dsc_t* image, uint32_t frame_duration_ms) {
+    auto& header = image->header;
+    uint32_t stride = header.stride != 0 ? header.stride : lv_draw_buf_width_to_stride(header.w, (lv_color_format_t)header.cf);
+    if (image->data_size < stride * header.h) {
+        // Compressed or encoded images would need a decoder, they are not cached
+        ESP_LOGW(TAG, "Unsupported image for %s", name);
+        return false;
+    }
+    auto buffer = CreateBuffer(header.w, header.h, (lv_color_format_t)header.cf, stride);
+    if (buffer == nullptr) {
+        return false;
+    }
+    memcpy(buffer->data, image->data, stride * header.h);
+
+    auto& entry = GetEntry(name);
+    entry.frames.push_back(buffer);
+    if (frame_duration_ms > 0) {
+        entry.frame_duration_ms = frame_duration_ms;
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef EMOTION_ATLAS_H
+#define EMOTION_ATLAS_H
+
+#include <lvgl.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+
+// Emotion images kept in PSRAM, so switching emotions is an lv_image source swap
+// instead of rasterizing a large emoji glyph from flash every time.
+// An emotion with several frames is played as an animation.
+class EmotionAtlas {
+public:
+    struct Entry {
+        std::string name;
+        std::vector<lv_draw_buf_t*> frames;
+        uint32_t frame_duration_ms = 0;
+        const char* glyph = nullptr;    // set for a rendered glyph, nullptr for copied images
+        const lv_font_t* font = nullptr;
+    };
+
+    EmotionAtlas() = default;
+    ~EmotionAtlas();
+    EmotionAtlas(const EmotionAtlas&) = delete;
+    EmotionAtlas& operator=(const EmotionAtlas&) = delete;
+
+    // Pre-render a glyph with the font (ARGB8888 to blend on any theme), call with LVGL locked.
+    // The glyph string and the font are kept for RecolorGlyphs() and must outlive the atlas.
+    bool RenderGlyph(const char* name, const char* glyph, const lv_font_t* font, lv_color_t color);
+    // Draw the rendered glyphs again in a new color (theme switch), in place, call with LVGL locked
+    void RecolorGlyphs(lv_color_t color);
+    // Copy an image (usually in flash) as the next frame of an emotion
+    bool AddFrame(const char* name, const lv_image_dsc_t* image, uint32_t frame_duration_ms = 0);
+    void Clear();
+
+    const Entry* Find(const char* name) const;
+    inline size_t bytes() const { return bytes_; }
+    inline bool empty() const { return entries_.empty(); }
+
+private:
+    // deque keeps Entry pointers valid when emotions are added
+    std::deque<Entry> entries_;
+    size_t bytes_ = 0;
+
+    Entry& GetEntry(const char* name);
+    lv_draw_buf_t* CreateBuffer(uint32_t width, uint32_t height, lv_color_format_t cf, uint32_t stride);
+    void DrawGlyph(lv_draw_buf_t* buffer, const char* glyph, const lv_font_t* font, lv_color_t color);
+};
+
+#endif // EMOTION_ATLAS_H
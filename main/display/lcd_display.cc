@@ -9,6 +9,8 @@
 #include <esp_heap_caps.h>
 #include "assets/lang_config.h"
 #include <cstring>
+#include <strings.h>
+#include <cJSON.h>
 #include "settings.h"
 
 #include "board.h"
@@ -64,29 +66,199 @@ const ThemeColors LIGHT_THEME = {
     .low_battery = LIGHT_LOW_BATTERY_COLOR
 };
 
+// Keys of a theme definition in NVS, see LoadThemes
+static const struct {
+    const char* name;
+    lv_color_t ThemeColors::* color;
+} kThemeColorKeys[] = {
+    {"background", &ThemeColors::background},
+    {"text", &ThemeColors::text},
+    {"chat_background", &ThemeColors::chat_background},
+    {"user_bubble", &ThemeColors::user_bubble},
+    {"assistant_bubble", &ThemeColors::assistant_bubble},
+    {"system_bubble", &ThemeColors::system_bubble},
+    {"system_text", &ThemeColors::system_text},
+    {"border", &ThemeColors::border},
+    {"low_battery", &ThemeColors::low_battery},
+};
+
+struct Emotion {
+    const char* icon;
+    const char* text;
+};
+
+static const Emotion kEmotions[] = {
+    {"😶", "neutral"},
+    {"🙂", "happy"},
+    {"😆", "laughing"},
+    {"😂", "funny"},
+    {"😔", "sad"},
+    {"😠", "angry"},
+    {"😭", "crying"},
+    {"😍", "loving"},
+    {"😳", "embarrassed"},
+    {"😯", "surprised"},
+    {"😱", "shocked"},
+    {"🤔", "thinking"},
+    {"😉", "winking"},
+    {"😎", "cool"},
+    {"😌", "relaxed"},
+    {"🤤", "delicious"},
+    {"😘", "kissy"},
+    {"😏", "confident"},
+    {"😴", "sleepy"},
+    {"😜", "silly"},
+    {"🙄", "confused"}
+};
 
 LV_FONT_DECLARE(font_awesome_30_4);
 
+// Kconfig overrides the board choice, which overrides the panel default
+static LcdBufferConfig ResolveBufferConfig(LcdBufferConfig config, const LcdBufferConfig& panel_default) {
+    if (config.strategy == kLcdBufferDefault) {
+        config.strategy = panel_default.strategy;
+    }
+    if (config.lines <= 0) {
+        config.lines = panel_default.lines;
+    }
+#if CONFIG_LCD_BUFFER_STRATEGY_LINES
+    config.strategy = kLcdBufferLines;
+#elif CONFIG_LCD_BUFFER_STRATEGY_DOUBLE_LINES
+    config.strategy = kLcdBufferDoubleLines;
+#elif CONFIG_LCD_BUFFER_STRATEGY_PSRAM_FULL_FRAME
+    config.strategy = kLcdBufferPsramFullFrame;
+#elif CONFIG_LCD_BUFFER_STRATEGY_DIRECT
+    config.strategy = kLcdBufferDirect;
+#endif
+#if CONFIG_LCD_BUFFER_LINES > 0
+    config.lines = CONFIG_LCD_BUFFER_LINES;
+#endif
+    return config;
+}
+
+static void ApplyBufferConfig(lvgl_port_display_cfg_t& cfg, const LcdBufferConfig& config, int width, int height) {
+    static const char* names[] = {"default", "lines", "double lines", "psram full frame", "direct"};
+    ESP_LOGI(TAG, "Draw buffer: %s, %d lines", names[config.strategy], config.lines);
+
+    uint32_t lines_size = static_cast<uint32_t>(width * config.lines);
+    uint32_t frame_size = static_cast<uint32_t>(width * height);
+    switch (config.strategy) {
+    case kLcdBufferDoubleLines:
+        cfg.buffer_size = lines_size;
+        cfg.double_buffer = true;
+        cfg.flags.buff_dma = 1;
+        cfg.flags.buff_spiram = 0;
+        break;
+    case kLcdBufferPsramFullFrame:
+        // LVGL renders the whole frame in PSRAM, the port copies it out in DMA sized pieces
+        cfg.buffer_size = frame_size;
+        cfg.double_buffer = false;
+        cfg.trans_size = lines_size;
+        cfg.flags.buff_dma = 0;
+        cfg.flags.buff_spiram = 1;
+        break;
+    case kLcdBufferDirect:
+        cfg.buffer_size = frame_size;
+        cfg.double_buffer = true;
+        cfg.trans_size = lines_size;
+        cfg.flags.buff_dma = 0;
+        cfg.flags.buff_spiram = 1;
+        cfg.flags.direct_mode = 1;
+        break;
+    default:
+        cfg.buffer_size = lines_size;
+        cfg.double_buffer = false;
+        cfg.flags.buff_dma = 1;
+        cfg.flags.buff_spiram = 0;
+        break;
+    }
+}
+
 LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel, DisplayFonts fonts, int width, int height)
     : panel_io_(panel_io), panel_(panel), fonts_(fonts) {
     width_ = width;
     height_ = height;
 
     // Load theme from settings
+    LoadThemes();
     Settings settings("display", false);
     current_theme_name_ = settings.GetString("theme", "light");
 
     // Update the theme
-    if (current_theme_name_ == "dark") {
-        current_theme_ = DARK_THEME;
-    } else if (current_theme_name_ == "light") {
-        current_theme_ = LIGHT_THEME;
+    auto theme = FindTheme(current_theme_name_);
+    if (theme == nullptr) {
+        ESP_LOGW(TAG, "Theme %s not found, using light", current_theme_name_.c_str());
+        current_theme_name_ = "light";
+        theme = FindTheme(current_theme_name_);
+    }
+    current_theme_ = *theme;
+}
+
+// Custom themes are stored as JSON in display/themes, for example
+// {"ocean": {"base": "dark", "background": "#001F3F", "user_bubble": "#0074D9"}}
+// Missing colors are taken from the base theme, light by default.
+void LcdDisplay::LoadThemes() {
+    themes_.clear();
+    themes_.emplace_back("light", LIGHT_THEME);
+    themes_.emplace_back("dark", DARK_THEME);
+
+    Settings settings("display", false);
+    auto json = settings.GetString("themes");
+    if (json.empty()) {
+        return;
+    }
+    cJSON* root = cJSON_Parse(json.c_str());
+    if (!cJSON_IsObject(root)) {
+        ESP_LOGE(TAG, "Invalid themes in settings");
+        cJSON_Delete(root);
+        return;
+    }
+
+    cJSON* item = nullptr;
+    cJSON_ArrayForEach(item, root) {
+        if (!cJSON_IsObject(item)) {
+            continue;
+        }
+        auto base = cJSON_GetObjectItem(item, "base");
+        auto base_theme = FindTheme(cJSON_IsString(base) ? base->valuestring : "light");
+        ThemeColors colors = base_theme != nullptr ? *base_theme : LIGHT_THEME;
+        for (auto& key : kThemeColorKeys) {
+            auto value = cJSON_GetObjectItem(item, key.name);
+            if (cJSON_IsString(value)) {
+                const char* hex = value->valuestring[0] == '#' ? value->valuestring + 1 : value->valuestring;
+                colors.*key.color = lv_color_hex(strtoul(hex, nullptr, 16));
+            } else if (cJSON_IsNumber(value)) {
+                colors.*key.color = lv_color_hex(value->valueint);
+            }
+        }
+        AddTheme(item->string, colors);
+    }
+    cJSON_Delete(root);
+    ESP_LOGI(TAG, "Loaded %u themes", themes_.size());
+}
+
+const ThemeColors* LcdDisplay::FindTheme(const std::string& theme_name) const {
+    for (auto& theme : themes_) {
+        if (strcasecmp(theme.first.c_str(), theme_name.c_str()) == 0) {
+            return &theme.second;
+        }
     }
+    return nullptr;
+}
+
+void LcdDisplay::AddTheme(const std::string& theme_name, const ThemeColors& colors) {
+    for (auto& theme : themes_) {
+        if (strcasecmp(theme.first.c_str(), theme_name.c_str()) == 0) {
+            theme.second = colors;
+            return;
+        }
+    }
+    themes_.emplace_back(theme_name, colors);
 }
 
 SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                            int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy,
-                           DisplayFonts fonts)
+                           DisplayFonts fonts, LcdBufferConfig buffer_config)
     : LcdDisplay(panel_io, panel, fonts, width, height) {
 
     // draw white
@@ -109,7 +281,7 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
-    const lvgl_port_display_cfg_t display_cfg = {
+    lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
@@ -134,6 +306,7 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
             .direct_mode = 0,
         },
     };
+    ApplyBufferConfig(display_cfg, ResolveBufferConfig(buffer_config, {kLcdBufferLines, 20}), width_, height_);
 
     display_ = lvgl_port_add_disp(&display_cfg);
     if (display_ == nullptr) {
@@ -152,7 +325,7 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
 RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                            int width, int height, int offset_x, int offset_y,
                            bool mirror_x, bool mirror_y, bool swap_xy,
-                           DisplayFonts fonts)
+                           DisplayFonts fonts, LcdBufferConfig buffer_config)
     : LcdDisplay(panel_io, panel, fonts, width, height) {
 
     // draw white
@@ -171,7 +344,7 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
-    const lvgl_port_display_cfg_t display_cfg = {
+    lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .buffer_size = static_cast<uint32_t>(width_ * 20),
@@ -191,12 +364,22 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         },
     };
 
-    const lvgl_port_display_rgb_cfg_t rgb_cfg = {
+    lvgl_port_display_rgb_cfg_t rgb_cfg = {
         .flags = {
             .bb_mode = true,
             .avoid_tearing = true,
         }
     };
+    // The panel frame buffers are used directly by default, other strategies render into separate buffers
+    auto config = ResolveBufferConfig(buffer_config, {kLcdBufferDirect, 20});
+    if (config.strategy == kLcdBufferDirect) {
+        ESP_LOGI(TAG, "Draw buffer: panel frame buffers, direct mode");
+    } else {
+        display_cfg.flags.full_refresh = 0;
+        display_cfg.flags.direct_mode = 0;
+        rgb_cfg.flags.avoid_tearing = false;
+        ApplyBufferConfig(display_cfg, config, width_, height_);
+    }
     
     display_ = lvgl_port_add_disp_rgb(&display_cfg, &rgb_cfg);
     if (display_ == nullptr) {
@@ -214,7 +397,7 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
 MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                             int width, int height,  int offset_x, int offset_y,
                             bool mirror_x, bool mirror_y, bool swap_xy,
-                            DisplayFonts fonts)
+                            DisplayFonts fonts, LcdBufferConfig buffer_config)
     : LcdDisplay(panel_io, panel, fonts, width, height) {
 
     // Set the display to on
@@ -229,7 +412,7 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
-    const lvgl_port_display_cfg_t disp_cfg = {
+    lvgl_port_display_cfg_t disp_cfg = {
             .io_handle = panel_io,
             .panel_handle = panel,
             .control_handle = nullptr,
@@ -250,6 +433,7 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
             .sw_rotate = false,
         },
     };
+    ApplyBufferConfig(disp_cfg, ResolveBufferConfig(buffer_config, {kLcdBufferLines, 50}), width_, height_);
 
     const lvgl_port_display_dsi_cfg_t dpi_cfg = {
         .flags = {
@@ -270,6 +454,11 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
 }
 
 LcdDisplay::~LcdDisplay() {
+#if CONFIG_USE_EMOTION_ATLAS
+    if (emotion_timer_ != nullptr) {
+        lv_timer_delete(emotion_timer_);
+    }
+#endif
     // 然后再清理 LVGL 对象
     if (content_ != nullptr) {
         lv_obj_del(content_);
@@ -283,9 +472,29 @@ LcdDisplay::~LcdDisplay() {
     if (container_ != nullptr) {
         lv_obj_del(container_);
     }
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    if (chat_text_arena_ != nullptr) {
+        heap_caps_free(chat_text_arena_);
+    }
+    if (!chat_rows_.empty()) {
+        lv_style_reset(&chat_row_style_);
+        lv_style_reset(&chat_bubble_style_);
+        lv_style_reset(&chat_text_style_);
+        for (int i = 0; i < kChatRoleCount; i++) {
+            lv_style_reset(&chat_row_role_styles_[i]);
+            lv_style_reset(&chat_bubble_role_styles_[i]);
+        }
+    }
+#endif
     if (display_ != nullptr) {
         lv_display_delete(display_);
     }
+    // The screen and the popup use the theme styles until the display is deleted
+    if (container_ != nullptr) {
+        for (auto& style : theme_styles_) {
+            lv_style_reset(&style);
+        }
+    }
 
     if (panel_ != nullptr) {
         esp_lcd_panel_del(panel_);
@@ -306,11 +515,11 @@ void LcdDisplay::Unlock() {
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    InitThemeStyles();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
+    lv_obj_add_style(screen, &theme_styles_[kThemeStyleScreen], 0);
 
     /* Container */
     container_ = lv_obj_create(screen);
@@ -319,15 +528,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_pad_all(container_, 0, 0);
     lv_obj_set_style_border_width(container_, 0, 0);
     lv_obj_set_style_pad_row(container_, 0, 0);
-    lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-    lv_obj_set_style_border_color(container_, current_theme_.border, 0);
+    lv_obj_add_style(container_, &theme_styles_[kThemeStyleContainer], 0);
 
     /* Status bar */
     status_bar_ = lv_obj_create(container_);
     lv_obj_set_size(status_bar_, LV_HOR_RES, LV_SIZE_CONTENT);
     lv_obj_set_style_radius(status_bar_, 0, 0);
-    lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-    lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
+    lv_obj_add_style(status_bar_, &theme_styles_[kThemeStyleStatusBar], 0);
     
     /* Content - Chat area */
     content_ = lv_obj_create(container_);
@@ -335,8 +542,7 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(content_, LV_HOR_RES);
     lv_obj_set_flex_grow(content_, 1);
     lv_obj_set_style_pad_all(content_, 10, 0);
-    lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0); // Background for chat area
-    lv_obj_set_style_border_color(content_, current_theme_.border, 0); // Border color for chat area
+    lv_obj_add_style(content_, &theme_styles_[kThemeStyleContent], 0); // Background and border for chat area
 
     // Enable scrolling for chat content
     lv_obj_set_scrollbar_mode(content_, LV_SCROLLBAR_MODE_OFF);
@@ -347,8 +553,38 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_align(content_, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_START);
     lv_obj_set_style_pad_row(content_, 10, 0); // Space between messages
 
-    // We'll create chat messages dynamically in SetChatMessage
+    // Create the pooled message rows up front, SetChatMessage only re-skins them
+    chat_rows_.resize(CHAT_VISIBLE_MESSAGES);
+    // Labels use static text from one arena, so messages never reallocate label text
+    size_t arena_size = CHAT_VISIBLE_MESSAGES * CHAT_BUBBLE_TEXT_CAPACITY;
+    chat_text_arena_ = (char*)heap_caps_malloc(arena_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (chat_text_arena_ == nullptr) {
+        // Fallback to internal RAM if SPIRAM allocation fails
+        chat_text_arena_ = (char*)heap_caps_malloc(arena_size, MALLOC_CAP_8BIT);
+    }
+    assert(chat_text_arena_ != nullptr);
+    for (size_t i = 0; i < chat_rows_.size(); i++) {
+        auto& row = chat_rows_[i];
+        row.text = chat_text_arena_ + i * CHAT_BUBBLE_TEXT_CAPACITY;
+        row.text[0] = '\0';
+        row.row = lv_obj_create(content_);
+        lv_obj_remove_style_all(row.row);
+        lv_obj_add_style(row.row, &chat_row_style_, 0);
+        lv_obj_clear_flag(row.row, LV_OBJ_FLAG_SCROLLABLE);
+        lv_obj_add_flag(row.row, LV_OBJ_FLAG_HIDDEN);
+
+        row.bubble = lv_obj_create(row.row);
+        lv_obj_remove_style_all(row.bubble);
+        lv_obj_add_style(row.bubble, &chat_bubble_style_, 0);
+        lv_obj_clear_flag(row.bubble, LV_OBJ_FLAG_SCROLLABLE);
+
+        row.label = lv_label_create(row.bubble);
+        lv_obj_add_style(row.label, &chat_text_style_, 0);
+        lv_label_set_long_mode(row.label, LV_LABEL_LONG_WRAP);
+        lv_label_set_text_static(row.label, row.text);
+    }
     chat_message_label_ = nullptr;
+    lv_obj_add_event_cb(content_, OnChatScrollEnd, LV_EVENT_SCROLL_END, this);
 
     /* Status bar */
     lv_obj_set_flex_flow(status_bar_, LV_FLEX_FLOW_ROW);
@@ -366,14 +602,14 @@ void LcdDisplay::SetupUI() {
     // 创建emotion_label_在状态栏最左侧
     emotion_label_ = lv_label_create(status_bar_);
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
-    lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
+    lv_obj_add_style(emotion_label_, &theme_styles_[kThemeStyleText], 0);
     lv_label_set_text(emotion_label_, FONT_AWESOME_AI_CHIP);
     lv_obj_set_style_margin_right(emotion_label_, 5, 0); // 添加右边距，与后面的元素分隔
 
     notification_label_ = lv_label_create(status_bar_);
     lv_obj_set_flex_grow(notification_label_, 1);
     lv_obj_set_style_text_align(notification_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
+    lv_obj_add_style(notification_label_, &theme_styles_[kThemeStyleText], 0);
     lv_label_set_text(notification_label_, "");
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
@@ -381,285 +617,305 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_grow(status_label_, 1);
     lv_label_set_long_mode(status_label_, LV_LABEL_LONG_SCROLL_CIRCULAR);
     lv_obj_set_style_text_align(status_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
+    lv_obj_add_style(status_label_, &theme_styles_[kThemeStyleText], 0);
     lv_label_set_text(status_label_, Lang::Strings::INITIALIZING);
     
     mute_label_ = lv_label_create(status_bar_);
     lv_label_set_text(mute_label_, "");
     lv_obj_set_style_text_font(mute_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
+    lv_obj_add_style(mute_label_, &theme_styles_[kThemeStyleText], 0);
 
     network_label_ = lv_label_create(status_bar_);
     lv_label_set_text(network_label_, "");
     lv_obj_set_style_text_font(network_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
+    lv_obj_add_style(network_label_, &theme_styles_[kThemeStyleText], 0);
     lv_obj_set_style_margin_left(network_label_, 5, 0); // 添加左边距，与前面的元素分隔
 
     battery_label_ = lv_label_create(status_bar_);
     lv_label_set_text(battery_label_, "");
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
+    lv_obj_add_style(battery_label_, &theme_styles_[kThemeStyleText], 0);
     lv_obj_set_style_margin_left(battery_label_, 5, 0); // 添加左边距，与前面的元素分隔
 
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, fonts_.text_font->line_height * 2);
     lv_obj_align(low_battery_popup_, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
+    lv_obj_add_style(low_battery_popup_, &theme_styles_[kThemeStyleLowBattery], 0);
     lv_obj_set_style_radius(low_battery_popup_, 10, 0);
     low_battery_label_ = lv_label_create(low_battery_popup_);
     lv_label_set_text(low_battery_label_, Lang::Strings::BATTERY_NEED_CHARGE);
     lv_obj_set_style_text_color(low_battery_label_, lv_color_white(), 0);
     lv_obj_center(low_battery_label_);
     lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-}
-#if CONFIG_IDF_TARGET_ESP32P4
-#define  MAX_MESSAGES 40
-#else
-#define  MAX_MESSAGES 20
+
+#if CONFIG_USE_EMOTION_ATLAS
+    InitEmotionAtlas();
 #endif
-void LcdDisplay::SetChatMessage(const char* role, const char* content) {
-    DisplayLockGuard lock(this);
-    if (content_ == nullptr) {
-        return;
+    StartCommandQueue();
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    StartBenchmark();
+#endif
+}
+
+void LcdDisplay::InitChatStyles() {
+    lv_style_init(&chat_row_style_);
+    lv_style_set_width(&chat_row_style_, lv_pct(100));
+    lv_style_set_height(&chat_row_style_, LV_SIZE_CONTENT);
+    lv_style_set_layout(&chat_row_style_, LV_LAYOUT_FLEX);
+    lv_style_set_flex_flow(&chat_row_style_, LV_FLEX_FLOW_ROW);
+
+    // User messages on the right, assistant on the left, system centered
+    static const lv_flex_align_t row_places[kChatRoleCount] = {
+        LV_FLEX_ALIGN_END, LV_FLEX_ALIGN_START, LV_FLEX_ALIGN_CENTER
+    };
+    for (int i = 0; i < kChatRoleCount; i++) {
+        lv_style_init(&chat_row_role_styles_[i]);
+        lv_style_set_flex_main_place(&chat_row_role_styles_[i], row_places[i]);
+        lv_style_init(&chat_bubble_role_styles_[i]);
     }
-    
-    //避免出现空的消息框
-    if(strlen(content) == 0) return;
-    
-    // 检查消息数量是否超过限制
-    uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // 删除最早的消息（第一个子对象）
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
-        }
-        // Scroll to the last message immediately
-        if (last_child != nullptr) {
-            lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
+
+    lv_style_init(&chat_bubble_style_);
+    lv_style_set_width(&chat_bubble_style_, LV_SIZE_CONTENT);
+    lv_style_set_height(&chat_bubble_style_, LV_SIZE_CONTENT);
+    lv_style_set_radius(&chat_bubble_style_, 8);
+    lv_style_set_border_width(&chat_bubble_style_, 1);
+    lv_style_set_pad_all(&chat_bubble_style_, 8);
+    lv_style_set_bg_opa(&chat_bubble_style_, LV_OPA_COVER);
+
+    lv_style_init(&chat_text_style_);
+    lv_style_set_text_font(&chat_text_style_, fonts_.text_font);
+}
+
+void LcdDisplay::UpdateChatStyles() {
+    lv_style_set_border_color(&chat_bubble_style_, current_theme_.border);
+    lv_style_set_bg_color(&chat_bubble_role_styles_[kChatRoleUser], current_theme_.user_bubble);
+    lv_style_set_text_color(&chat_bubble_role_styles_[kChatRoleUser], current_theme_.text);
+    lv_style_set_bg_color(&chat_bubble_role_styles_[kChatRoleAssistant], current_theme_.assistant_bubble);
+    lv_style_set_text_color(&chat_bubble_role_styles_[kChatRoleAssistant], current_theme_.text);
+    lv_style_set_bg_color(&chat_bubble_role_styles_[kChatRoleSystem], current_theme_.system_bubble);
+    lv_style_set_text_color(&chat_bubble_role_styles_[kChatRoleSystem], current_theme_.system_text);
+}
+
+LcdDisplay::ChatRow& LcdDisplay::AcquireChatRow() {
+    if (chat_rows_used_ < chat_rows_.size()) {
+        return chat_rows_[(chat_row_first_ + chat_rows_used_++) % chat_rows_.size()];
+    }
+    // All rows are visible, recycle the oldest one
+    auto& row = chat_rows_[chat_row_first_];
+    chat_row_first_ = (chat_row_first_ + 1) % chat_rows_.size();
+    return row;
+}
+
+void LcdDisplay::BindChatRow(ChatRow& row, uint8_t role, const char* text) {
+    if (row.role != role) {
+        if (row.role >= 0) {
+            lv_obj_remove_style(row.row, &chat_row_role_styles_[row.role], 0);
+            lv_obj_remove_style(row.bubble, &chat_bubble_role_styles_[row.role], 0);
         }
+        lv_obj_add_style(row.row, &chat_row_role_styles_[role], 0);
+        lv_obj_add_style(row.bubble, &chat_bubble_role_styles_[role], 0);
+        row.role = role;
     }
-    
-    // 折叠系统消息（如果是系统消息，检查最后一个消息是否也是系统消息）
-    if (strcmp(role, "system") == 0 && child_count > 0) {
-        // 获取最后一个消息容器
-        lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
-        if (last_container != nullptr && lv_obj_get_child_cnt(last_container) > 0) {
-            // 获取容器内的气泡
-            lv_obj_t* last_bubble = lv_obj_get_child(last_container, 0);
-            if (last_bubble != nullptr) {
-                // 检查气泡类型是否为系统消息
-                void* bubble_type_ptr = lv_obj_get_user_data(last_bubble);
-                if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
-                    // 如果最后一个消息也是系统消息，则删除它
-                    lv_obj_del(last_container);
-                }
-            }
+    row.text_length = 0;
+    row.text[0] = '\0';
+    row.text_width = 0;
+    AppendChatRow(row, text);
+
+    lv_obj_clear_flag(row.row, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_move_to_index(row.row, -1);
+}
+
+bool LcdDisplay::AppendChatRow(ChatRow& row, const char* delta) {
+    size_t length = strlen(delta);
+    if (row.text_length + length >= CHAT_BUBBLE_TEXT_CAPACITY) {
+        if (row.text_length > 0) {
+            return false;
+        }
+        // A message longer than the arena is cut on a UTF-8 boundary
+        length = CHAT_BUBBLE_TEXT_CAPACITY - 1;
+        while (length > 0 && (delta[length] & 0xC0) == 0x80) {
+            length--;
         }
     }
-    
-    // Create a message bubble
-    lv_obj_t* msg_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(msg_bubble, 8, 0);
-    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(msg_bubble, 1, 0);
-    lv_obj_set_style_border_color(msg_bubble, current_theme_.border, 0);
-    lv_obj_set_style_pad_all(msg_bubble, 8, 0);
-
-    // Create the message text
-    lv_obj_t* msg_text = lv_label_create(msg_bubble);
-    lv_label_set_text(msg_text, content);
-    
-    // 计算文本实际宽度
-    lv_coord_t text_width = lv_txt_get_width(content, strlen(content), fonts_.text_font, 0);
+    memcpy(row.text + row.text_length, delta, length);
+    row.text_length += length;
+    row.text[row.text_length] = '\0';
+
+    // 计算气泡宽度，最小 20，最大为屏幕宽度的85%
+    // Only the appended text is measured, a bubble that already wraps keeps the maximum width
+    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+    if (row.text_width < max_width) {
+        row.text_width += lv_txt_get_width(row.text + row.text_length - length, length, fonts_.text_font, 0);
+        lv_obj_set_width(row.label, std::clamp<lv_coord_t>(row.text_width, 20, max_width));
+    }
+    lv_label_set_text_static(row.label, row.text);
+    return true;
+}
 
-    // 计算气泡宽度
-    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;  // 屏幕宽度的85%
-    lv_coord_t min_width = 20;  
-    lv_coord_t bubble_width;
-    
-    // 确保文本宽度不小于最小宽度
-    if (text_width < min_width) {
-        text_width = min_width;
+void LcdDisplay::ShowChatHistory(size_t end) {
+    // Image previews are not part of the history
+    for (auto image_bubble : image_bubbles_) {
+        lv_obj_del(image_bubble);
     }
+    image_bubbles_.clear();
 
-    // 如果文本宽度小于最大宽度，使用文本宽度
-    if (text_width < max_width) {
-        bubble_width = text_width; 
-    } else {
-        bubble_width = max_width;
+    size_t count = std::min(end, chat_rows_.size());
+    chat_row_first_ = 0;
+    chat_rows_used_ = 0;
+    for (size_t i = end - count; i < end; i++) {
+        BindChatRow(AcquireChatRow(), chat_history_.role(i), chat_history_.text(i));
     }
-    
-    // 设置消息文本的宽度
-    lv_obj_set_width(msg_text, bubble_width);  // 减去padding
-    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
-    lv_obj_set_style_text_font(msg_text, fonts_.text_font, 0);
+    for (size_t i = count; i < chat_rows_.size(); i++) {
+        lv_obj_add_flag(chat_rows_[i].row, LV_OBJ_FLAG_HIDDEN);
+    }
+    chat_window_end_ = end;
+}
 
-    // 设置气泡宽度
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
+void LcdDisplay::OnChatScrollEnd(lv_event_t* e) {
+    auto display = static_cast<LcdDisplay*>(lv_event_get_user_data(e));
+    auto content = display->content_;
+    size_t rows = display->chat_rows_used_;
+    size_t step = std::max<size_t>(display->chat_rows_.size() / 2, 1);
+    size_t end = display->chat_window_end_;
+
+    // Page older or newer messages from the history into the pooled rows
+    size_t anchor;
+    if (lv_obj_get_scroll_top(content) <= 0 && end > rows) {
+        size_t shift = std::min(step, end - rows);
+        display->ShowChatHistory(end - shift);
+        anchor = shift;
+    } else if (lv_obj_get_scroll_bottom(content) <= 0 && end < display->chat_history_.size()) {
+        size_t shift = std::min(step, display->chat_history_.size() - end);
+        display->ShowChatHistory(end + shift);
+        anchor = display->chat_rows_used_ - 1 - shift;
+    } else {
+        return;
+    }
+    // Keep the message that was at the edge in view
+    lv_obj_update_layout(content);
+    lv_obj_scroll_to_view(display->chat_rows_[anchor].row, LV_ANIM_OFF);
+}
 
-    // Set alignment and style based on message role
+static uint8_t ParseChatRole(const char* role) {
     if (strcmp(role, "user") == 0) {
-        // User messages are right-aligned with green background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.user_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"user");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "assistant") == 0) {
-        // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.assistant_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+        return kChatRoleUser;
     } else if (strcmp(role, "system") == 0) {
-        // System messages are center-aligned with light gray background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.system_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.system_text, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(msg_bubble, (void*)"system");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+        return kChatRoleSystem;
     }
-    
-    // Create a full-width container for user messages to ensure right alignment
-    if (strcmp(role, "user") == 0) {
-        // Create a full-width container
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // Move the message bubble into this container
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
-        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else if (strcmp(role, "system") == 0) {
-        // 为系统消息创建全宽容器以确保居中对齐
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // 使容器透明且无边框
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // 将消息气泡移入此容器
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // 将气泡居中对齐在容器中
-        lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        
-        // 自动滚动底部
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else {
-        // For assistant messages
-        // Left align assistant messages
-        lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
+    return kChatRoleAssistant;
+}
 
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
+void LcdDisplay::SetChatMessageImpl(const char* role, const char* content) {
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr) {
+        return;
     }
     
+    //避免出现空的消息框
+    if(strlen(content) == 0) return;
+
+    auto start_time = esp_timer_get_time();
+    auto free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    uint8_t chat_role = ParseChatRole(role);
+    bool following = chat_window_end_ == chat_history_.size();
+    
+    // 折叠系统消息（如果上一条也是系统消息，则替换它）
+    size_t history_size = chat_history_.size();
+    if (chat_role == kChatRoleSystem && history_size > 0 && chat_history_.role(history_size - 1) == kChatRoleSystem) {
+        chat_history_.RemoveLast();
+        if (following && chat_rows_used_ > 0) {
+            chat_rows_used_--;
+            lv_obj_add_flag(chat_rows_[(chat_row_first_ + chat_rows_used_) % chat_rows_.size()].row, LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+    chat_history_.Append(chat_role, content);
+
+    if (following) {
+        auto& row = AcquireChatRow();
+        BindChatRow(row, chat_role, content);
+        chat_window_end_ = chat_history_.size();
+    } else {
+        // The user scrolled back in the history, jump to the latest messages
+        ShowChatHistory(chat_history_.size());
+    }
+
+    // Auto-scroll to the latest message
+    auto& last_row = chat_rows_[(chat_row_first_ + chat_rows_used_ - 1) % chat_rows_.size()];
+    lv_obj_scroll_to_view_recursive(last_row.row, LV_ANIM_ON);
+
     // Store reference to the latest message label
-    chat_message_label_ = msg_text;
+    chat_message_label_ = last_row.label;
+
+    ESP_LOGD(TAG, "SetChatMessageImpl took %ld us, heap delta %ld bytes",
+        (long)(esp_timer_get_time() - start_time), (long)free_heap - (long)heap_caps_get_free_size(MALLOC_CAP_8BIT));
 }
 
-void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
+void LcdDisplay::AppendChatMessageImpl(const char* role, const char* delta) {
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr || delta[0] == '\0') {
+        return;
+    }
+
+    // Only the newest message grows, system messages are never streamed
+    uint8_t chat_role = ParseChatRole(role);
+    size_t history_size = chat_history_.size();
+    if (chat_role == kChatRoleSystem || history_size == 0 || chat_history_.role(history_size - 1) != chat_role) {
+        SetChatMessageImpl(role, delta);
+        return;
+    }
+
+    auto start_time = esp_timer_get_time();
+    bool following = chat_window_end_ == history_size;
+    if (following && chat_rows_used_ > 0) {
+        auto& last_row = chat_rows_[(chat_row_first_ + chat_rows_used_ - 1) % chat_rows_.size()];
+        if (!AppendChatRow(last_row, delta)) {
+            // The bubble is full, continue in a new one
+            SetChatMessageImpl(role, delta);
+            return;
+        }
+        chat_history_.ExtendLast(delta);
+        // ExtendLast may evict the oldest entries, the window still ends at the newest one
+        chat_window_end_ = chat_history_.size();
+        lv_obj_scroll_to_view_recursive(last_row.row, LV_ANIM_ON);
+    } else {
+        // The user scrolled back in the history, jump to the latest messages
+        chat_history_.ExtendLast(delta);
+        ShowChatHistory(chat_history_.size());
+    }
+
+    ESP_LOGD(TAG, "AppendChatMessageImpl took %ld us", (long)(esp_timer_get_time() - start_time));
+}
+
+void LcdDisplay::SetPreviewImage(std::unique_ptr<PreviewImage> image) {
     DisplayLockGuard lock(this);
     if (content_ == nullptr) {
         return;
     }
     
-    if (img_dsc != nullptr) {
-        // Create a message bubble for image preview
+    if (image != nullptr) {
+        // Create a message bubble for image preview, styled like assistant messages
         lv_obj_t* img_bubble = lv_obj_create(content_);
-        lv_obj_set_style_radius(img_bubble, 8, 0);
-        lv_obj_set_scrollbar_mode(img_bubble, LV_SCROLLBAR_MODE_OFF);
-        lv_obj_set_style_border_width(img_bubble, 1, 0);
-        lv_obj_set_style_border_color(img_bubble, current_theme_.border, 0);
-        lv_obj_set_style_pad_all(img_bubble, 8, 0);
-        
-        // Set image bubble background color (similar to system message)
-        lv_obj_set_style_bg_color(img_bubble, current_theme_.assistant_bubble, 0);
-        
-        // 设置自定义属性标记气泡类型
-        lv_obj_set_user_data(img_bubble, (void*)"image");
+        lv_obj_remove_style_all(img_bubble);
+        lv_obj_add_style(img_bubble, &chat_bubble_style_, 0);
+        lv_obj_add_style(img_bubble, &chat_bubble_role_styles_[kChatRoleAssistant], 0);
+        lv_obj_clear_flag(img_bubble, LV_OBJ_FLAG_SCROLLABLE);
         
         // Create the image object inside the bubble
         lv_obj_t* preview_image = lv_image_create(img_bubble);
         
-        // Copy the image descriptor and data to avoid source data changes
-        lv_img_dsc_t* copied_img_dsc = (lv_img_dsc_t*)heap_caps_malloc(sizeof(lv_img_dsc_t), MALLOC_CAP_8BIT);
-        if (copied_img_dsc == nullptr) {
-            ESP_LOGE(TAG, "Failed to allocate memory for image descriptor");
-            lv_obj_del(img_bubble);
-            return;
-        }
-        
-        // Copy the header
-        copied_img_dsc->header = img_dsc->header;
-        copied_img_dsc->data_size = img_dsc->data_size;
-        
-        // Copy the image data
-        uint8_t* copied_data = (uint8_t*)heap_caps_malloc(img_dsc->data_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-        if (copied_data == nullptr) {
-            // Fallback to internal RAM if SPIRAM allocation fails
-            copied_data = (uint8_t*)heap_caps_malloc(img_dsc->data_size, MALLOC_CAP_8BIT);
-        }
-        if (copied_data == nullptr) {
-            ESP_LOGE(TAG, "Failed to allocate memory for image data (size: %lu bytes)", img_dsc->data_size);
-            heap_caps_free(copied_img_dsc);
-            lv_obj_del(img_bubble);
-            return;
-        }
-        
-        memcpy(copied_data, img_dsc->data, img_dsc->data_size);
-        copied_img_dsc->data = copied_data;
+        // The bubble owns the preview, so no copy is needed
+        auto preview = image.release();
+        lv_img_dsc_t* img_dsc = &preview->image;
         
         // Calculate appropriate size for the image
         lv_coord_t max_width = LV_HOR_RES * 70 / 100;  // 70% of screen width
         lv_coord_t max_height = LV_VER_RES * 50 / 100; // 50% of screen height
         
         // Calculate zoom factor to fit within maximum dimensions
-        lv_coord_t img_width = copied_img_dsc->header.w;
-        lv_coord_t img_height = copied_img_dsc->header.h;
+        lv_coord_t img_width = img_dsc->header.w;
+        lv_coord_t img_height = img_dsc->header.h;
         
         lv_coord_t zoom_w = (max_width * 256) / img_width;
         lv_coord_t zoom_h = (max_height * 256) / img_height;
@@ -669,17 +925,13 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
         if (zoom > 256) zoom = 256;
         
         // Set image properties
-        lv_image_set_src(preview_image, copied_img_dsc);
+        lv_image_set_src(preview_image, img_dsc);
         lv_image_set_scale(preview_image, zoom);
         
-        // Add event handler to clean up copied data when image is deleted
+        // Free the preview when the image is deleted
         lv_obj_add_event_cb(preview_image, [](lv_event_t* e) {
-            lv_img_dsc_t* copied_img_dsc = (lv_img_dsc_t*)lv_event_get_user_data(e);
-            if (copied_img_dsc != nullptr) {
-                heap_caps_free((void*)copied_img_dsc->data);
-                heap_caps_free(copied_img_dsc);
-            }
-        }, LV_EVENT_DELETE, (void*)copied_img_dsc);
+            delete static_cast<PreviewImage*>(lv_event_get_user_data(e));
+        }, LV_EVENT_DELETE, preview);
         
         // Calculate actual scaled image dimensions
         lv_coord_t scaled_width = (img_width * zoom) / 256;
@@ -698,6 +950,13 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
         // Left align the image bubble like assistant messages
         lv_obj_align(img_bubble, LV_ALIGN_LEFT_MID, 0, 0);
 
+        // Keep only the latest previews, the image data is freed with the bubble
+        image_bubbles_.push_back(img_bubble);
+        if (image_bubbles_.size() > CHAT_MAX_IMAGE_BUBBLES) {
+            lv_obj_del(image_bubbles_.front());
+            image_bubbles_.erase(image_bubbles_.begin());
+        }
+
         // Auto-scroll to the image bubble
         lv_obj_scroll_to_view_recursive(img_bubble, LV_ANIM_ON);
     }
@@ -705,11 +964,11 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
 #else
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    InitThemeStyles();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
+    lv_obj_add_style(screen, &theme_styles_[kThemeStyleScreen], 0);
 
     /* Container */
     container_ = lv_obj_create(screen);
@@ -718,15 +977,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_pad_all(container_, 0, 0);
     lv_obj_set_style_border_width(container_, 0, 0);
     lv_obj_set_style_pad_row(container_, 0, 0);
-    lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-    lv_obj_set_style_border_color(container_, current_theme_.border, 0);
+    lv_obj_add_style(container_, &theme_styles_[kThemeStyleContainer], 0);
 
     /* Status bar */
     status_bar_ = lv_obj_create(container_);
     lv_obj_set_size(status_bar_, LV_HOR_RES, fonts_.text_font->line_height);
     lv_obj_set_style_radius(status_bar_, 0, 0);
-    lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-    lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
+    lv_obj_add_style(status_bar_, &theme_styles_[kThemeStyleStatusBar], 0);
     
     /* Content */
     content_ = lv_obj_create(container_);
@@ -735,15 +992,14 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(content_, LV_HOR_RES);
     lv_obj_set_flex_grow(content_, 1);
     lv_obj_set_style_pad_all(content_, 5, 0);
-    lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
-    lv_obj_set_style_border_color(content_, current_theme_.border, 0); // Border color for content
+    lv_obj_add_style(content_, &theme_styles_[kThemeStyleContent], 0); // Background and border for content
 
     lv_obj_set_flex_flow(content_, LV_FLEX_FLOW_COLUMN); // 垂直布局（从上到下）
     lv_obj_set_flex_align(content_, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_SPACE_EVENLY); // 子对象居中对齐，等距分布
 
     emotion_label_ = lv_label_create(content_);
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
-    lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
+    lv_obj_add_style(emotion_label_, &theme_styles_[kThemeStyleText], 0);
     lv_label_set_text(emotion_label_, FONT_AWESOME_AI_CHIP);
 
     preview_image_ = lv_image_create(content_);
@@ -756,7 +1012,7 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(chat_message_label_, LV_HOR_RES * 0.9); // 限制宽度为屏幕宽度的 90%
     lv_label_set_long_mode(chat_message_label_, LV_LABEL_LONG_WRAP); // 设置为自动换行模式
     lv_obj_set_style_text_align(chat_message_label_, LV_TEXT_ALIGN_CENTER, 0); // 设置文本居中对齐
-    lv_obj_set_style_text_color(chat_message_label_, current_theme_.text, 0);
+    lv_obj_add_style(chat_message_label_, &theme_styles_[kThemeStyleText], 0);
 
     /* Status bar */
     lv_obj_set_flex_flow(status_bar_, LV_FLEX_FLOW_ROW);
@@ -769,12 +1025,12 @@ void LcdDisplay::SetupUI() {
     network_label_ = lv_label_create(status_bar_);
     lv_label_set_text(network_label_, "");
     lv_obj_set_style_text_font(network_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
+    lv_obj_add_style(network_label_, &theme_styles_[kThemeStyleText], 0);
 
     notification_label_ = lv_label_create(status_bar_);
     lv_obj_set_flex_grow(notification_label_, 1);
     lv_obj_set_style_text_align(notification_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
+    lv_obj_add_style(notification_label_, &theme_styles_[kThemeStyleText], 0);
     lv_label_set_text(notification_label_, "");
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
@@ -782,50 +1038,70 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_grow(status_label_, 1);
     lv_label_set_long_mode(status_label_, LV_LABEL_LONG_SCROLL_CIRCULAR);
     lv_obj_set_style_text_align(status_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
+    lv_obj_add_style(status_label_, &theme_styles_[kThemeStyleText], 0);
     lv_label_set_text(status_label_, Lang::Strings::INITIALIZING);
     mute_label_ = lv_label_create(status_bar_);
     lv_label_set_text(mute_label_, "");
     lv_obj_set_style_text_font(mute_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
+    lv_obj_add_style(mute_label_, &theme_styles_[kThemeStyleText], 0);
 
     battery_label_ = lv_label_create(status_bar_);
     lv_label_set_text(battery_label_, "");
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
+    lv_obj_add_style(battery_label_, &theme_styles_[kThemeStyleText], 0);
 
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, fonts_.text_font->line_height * 2);
     lv_obj_align(low_battery_popup_, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
+    lv_obj_add_style(low_battery_popup_, &theme_styles_[kThemeStyleLowBattery], 0);
     lv_obj_set_style_radius(low_battery_popup_, 10, 0);
     low_battery_label_ = lv_label_create(low_battery_popup_);
     lv_label_set_text(low_battery_label_, Lang::Strings::BATTERY_NEED_CHARGE);
     lv_obj_set_style_text_color(low_battery_label_, lv_color_white(), 0);
     lv_obj_center(low_battery_label_);
     lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+
+#if CONFIG_USE_EMOTION_ATLAS
+    InitEmotionAtlas();
+#endif
+    StartCommandQueue();
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    StartBenchmark();
+#endif
 }
 
-void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
+void LcdDisplay::SetPreviewImage(std::unique_ptr<PreviewImage> image) {
     DisplayLockGuard lock(this);
     if (preview_image_ == nullptr) {
         return;
     }
     
-    if (img_dsc != nullptr) {
+    if (image != nullptr) {
         // zoom factor 0.5
-        lv_image_set_scale(preview_image_, 128 * width_ / img_dsc->header.w);
-        // 设置图片源并显示预览图片
-        lv_image_set_src(preview_image_, img_dsc);
+        lv_image_set_scale(preview_image_, 128 * width_ / image->image.header.w);
+        // 设置图片源并显示预览图片，上一张预览在此之后释放
+        lv_image_set_src(preview_image_, &image->image);
+        preview_data_ = std::move(image);
         lv_obj_clear_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
         // 隐藏emotion_label_
         if (emotion_label_ != nullptr) {
             lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
         }
+#if CONFIG_USE_EMOTION_ATLAS
+        if (emotion_image_ != nullptr) {
+            lv_obj_add_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+        }
+#endif
     } else {
         // 隐藏预览图片并显示emotion_label_
         lv_obj_add_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
+#if CONFIG_USE_EMOTION_ATLAS
+        if (emotion_entry_ != nullptr) {
+            lv_obj_clear_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+            return;
+        }
+#endif
         if (emotion_label_ != nullptr) {
             lv_obj_clear_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
         }
@@ -833,68 +1109,121 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
 }
 #endif
 
-void LcdDisplay::SetEmotion(const char* emotion) {
-    struct Emotion {
-        const char* icon;
-        const char* text;
-    };
-
-    static const std::vector<Emotion> emotions = {
-        {"😶", "neutral"},
-        {"🙂", "happy"},
-        {"😆", "laughing"},
-        {"😂", "funny"},
-        {"😔", "sad"},
-        {"😠", "angry"},
-        {"😭", "crying"},
-        {"😍", "loving"},
-        {"😳", "embarrassed"},
-        {"😯", "surprised"},
-        {"😱", "shocked"},
-        {"🤔", "thinking"},
-        {"😉", "winking"},
-        {"😎", "cool"},
-        {"😌", "relaxed"},
-        {"🤤", "delicious"},
-        {"😘", "kissy"},
-        {"😏", "confident"},
-        {"😴", "sleepy"},
-        {"😜", "silly"},
-        {"🙄", "confused"}
-    };
-    
+void LcdDisplay::SetEmotionImpl(const char* emotion) {
     // 查找匹配的表情
     std::string_view emotion_view(emotion);
-    auto it = std::find_if(emotions.begin(), emotions.end(),
+    auto it = std::find_if(std::begin(kEmotions), std::end(kEmotions),
         [&emotion_view](const Emotion& e) { return e.text == emotion_view; });
+    // 如果找到匹配的表情就显示对应图标，否则显示默认的neutral表情
+    auto& found = it != std::end(kEmotions) ? *it : kEmotions[0];
 
     DisplayLockGuard lock(this);
     if (emotion_label_ == nullptr) {
         return;
     }
 
-    // 如果找到匹配的表情就显示对应图标，否则显示默认的neutral表情
-    lv_obj_set_style_text_font(emotion_label_, fonts_.emoji_font, 0);
-    if (it != emotions.end()) {
-        lv_label_set_text(emotion_label_, it->icon);
-    } else {
-        lv_label_set_text(emotion_label_, "😶");
+    bool image_shown = false;
+#if CONFIG_USE_EMOTION_ATLAS
+    // Pre-rendered emotions only swap the image source
+    image_shown = ShowEmotionImage(emotion_atlas_.Find(found.text));
+#endif
+    if (!image_shown) {
+        lv_obj_set_style_text_font(emotion_label_, fonts_.emoji_font, 0);
+        lv_label_set_text(emotion_label_, found.icon);
     }
 
 #if !CONFIG_USE_WECHAT_MESSAGE_STYLE
-    // 显示emotion_label_，隐藏preview_image_
-    lv_obj_clear_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
+    // 显示表情（图片或emotion_label_二选一），隐藏preview_image_
+    if (!image_shown) {
+        lv_obj_clear_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
+#if CONFIG_USE_EMOTION_ATLAS
+        if (emotion_image_ != nullptr) {
+            lv_obj_add_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+        }
+#endif
+    }
     if (preview_image_ != nullptr) {
         lv_obj_add_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
     }
 #endif
 }
 
-void LcdDisplay::SetIcon(const char* icon) {
+#if CONFIG_USE_EMOTION_ATLAS
+void LcdDisplay::InitEmotionAtlas() {
+    if (fonts_.emoji_font == nullptr || emotion_label_ == nullptr) {
+        return;
+    }
+
+    // Rasterize every emoji once, switching emotions then reads nothing from flash
+    auto start_time = esp_timer_get_time();
+    for (auto& emotion : kEmotions) {
+        emotion_atlas_.RenderGlyph(emotion.text, emotion.icon, fonts_.emoji_font, current_theme_.text);
+    }
+    ESP_LOGI(TAG, "Emotion atlas: %u bytes in PSRAM, rendered in %ld ms", emotion_atlas_.bytes(),
+        (long)((esp_timer_get_time() - start_time) / 1000));
+    if (emotion_atlas_.empty()) {
+        return;
+    }
+
+    // Same place and spacing as emotion_label_, only one of them is visible
+    emotion_image_ = lv_image_create(lv_obj_get_parent(emotion_label_));
+    lv_obj_move_to_index(emotion_image_, lv_obj_get_index(emotion_label_) + 1);
+    lv_obj_set_style_margin_right(emotion_image_, lv_obj_get_style_margin_right(emotion_label_, 0), 0);
+    lv_obj_add_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+
+    emotion_timer_ = lv_timer_create([](lv_timer_t* timer) {
+        auto display = static_cast<LcdDisplay*>(lv_timer_get_user_data(timer));
+        auto entry = display->emotion_entry_;
+        if (entry == nullptr || entry->frames.size() < 2) {
+            return;
+        }
+        display->emotion_frame_ = (display->emotion_frame_ + 1) % entry->frames.size();
+        lv_image_set_src(display->emotion_image_, entry->frames[display->emotion_frame_]);
+    }, 100, this);
+    lv_timer_pause(emotion_timer_);
+}
+
+void LcdDisplay::AddEmotionFrame(const char* emotion, const lv_image_dsc_t* image, uint32_t frame_duration_ms) {
+    DisplayLockGuard lock(this);
+    emotion_atlas_.AddFrame(emotion, image, frame_duration_ms);
+}
+
+bool LcdDisplay::ShowEmotionImage(const EmotionAtlas::Entry* entry) {
+    if (emotion_image_ == nullptr) {
+        return false;
+    }
+    emotion_entry_ = entry;
+    emotion_frame_ = 0;
+    if (entry == nullptr || entry->frames.empty()) {
+        emotion_entry_ = nullptr;
+        lv_timer_pause(emotion_timer_);
+        lv_obj_add_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_clear_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
+        return false;
+    }
+
+    lv_image_set_src(emotion_image_, entry->frames[0]);
+    lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_clear_flag(emotion_image_, LV_OBJ_FLAG_HIDDEN);
+    if (entry->frames.size() > 1) {
+        lv_timer_set_period(emotion_timer_, entry->frame_duration_ms > 0 ? entry->frame_duration_ms : 100);
+        lv_timer_reset(emotion_timer_);
+        lv_timer_resume(emotion_timer_);
+    } else {
+        lv_timer_pause(emotion_timer_);
+    }
+    return true;
+}
+#endif
+
+void LcdDisplay::SetIconImpl(const char* icon) {
     DisplayLockGuard lock(this);
     if (emotion_label_ == nullptr) {
         return;
     }
+#if CONFIG_USE_EMOTION_ATLAS
+    ShowEmotionImage(nullptr);
+#endif
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
     lv_label_set_text(emotion_label_, icon);
 
@@ -907,195 +1236,52 @@ void LcdDisplay::SetIcon(const char* icon) {
 #endif
 }
 
+void LcdDisplay::InitThemeStyles() {
+    for (auto& style : theme_styles_) {
+        lv_style_init(&style);
+    }
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    InitChatStyles();
+#endif
+    UpdateThemeStyles();
+}
+
+void LcdDisplay::UpdateThemeStyles() {
+    lv_style_set_bg_color(&theme_styles_[kThemeStyleScreen], current_theme_.background);
+    lv_style_set_text_color(&theme_styles_[kThemeStyleScreen], current_theme_.text);
+    lv_style_set_bg_color(&theme_styles_[kThemeStyleContainer], current_theme_.background);
+    lv_style_set_border_color(&theme_styles_[kThemeStyleContainer], current_theme_.border);
+    lv_style_set_bg_color(&theme_styles_[kThemeStyleStatusBar], current_theme_.background);
+    lv_style_set_text_color(&theme_styles_[kThemeStyleStatusBar], current_theme_.text);
+    lv_style_set_bg_color(&theme_styles_[kThemeStyleContent], current_theme_.chat_background);
+    lv_style_set_border_color(&theme_styles_[kThemeStyleContent], current_theme_.border);
+    lv_style_set_text_color(&theme_styles_[kThemeStyleText], current_theme_.text);
+    lv_style_set_bg_color(&theme_styles_[kThemeStyleLowBattery], current_theme_.low_battery);
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    UpdateChatStyles();
+#endif
+    // One refresh for every object using any of the styles, whatever the chat history length
+    lv_obj_report_style_change(nullptr);
+}
+
 void LcdDisplay::SetTheme(const std::string& theme_name) {
-    DisplayLockGuard lock(this);
-    
-    if (theme_name == "dark" || theme_name == "DARK") {
-        current_theme_ = DARK_THEME;
-    } else if (theme_name == "light" || theme_name == "LIGHT") {
-        current_theme_ = LIGHT_THEME;
-    } else {
-        // Invalid theme name, return false
+    auto theme = FindTheme(theme_name);
+    if (theme == nullptr) {
         ESP_LOGE(TAG, "Invalid theme name: %s", theme_name.c_str());
         return;
     }
-    
-    // Get the active screen
-    lv_obj_t* screen = lv_screen_active();
-    
-    // Update the screen colors
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    
-    // Update container colors
-    if (container_ != nullptr) {
-        lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-        lv_obj_set_style_border_color(container_, current_theme_.border, 0);
-    }
-    
-    // Update status bar colors
-    if (status_bar_ != nullptr) {
-        lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-        lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
-        
-        // Update status bar elements
-        if (network_label_ != nullptr) {
-            lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
-        }
-        if (status_label_ != nullptr) {
-            lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
-        }
-        if (notification_label_ != nullptr) {
-            lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
-        }
-        if (mute_label_ != nullptr) {
-            lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
-        }
-        if (battery_label_ != nullptr) {
-            lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
-        }
-        if (emotion_label_ != nullptr) {
-            lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
-        }
-    }
-    
-    // Update content area colors
-    if (content_ != nullptr) {
-        lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
-        lv_obj_set_style_border_color(content_, current_theme_.border, 0);
-        
-        // If we have the chat message style, update all message bubbles
-#if CONFIG_USE_WECHAT_MESSAGE_STYLE
-        // Iterate through all children of content (message containers or bubbles)
-        uint32_t child_count = lv_obj_get_child_cnt(content_);
-        for (uint32_t i = 0; i < child_count; i++) {
-            lv_obj_t* obj = lv_obj_get_child(content_, i);
-            if (obj == nullptr) continue;
-            
-            lv_obj_t* bubble = nullptr;
-            
-            // 检查这个对象是容器还是气泡
-            // 如果是容器（用户或系统消息），则获取其子对象作为气泡
-            // 如果是气泡（助手消息），则直接使用
-            if (lv_obj_get_child_cnt(obj) > 0) {
-                // 可能是容器，检查它是否为用户或系统消息容器
-                // 用户和系统消息容器是透明的
-                lv_opa_t bg_opa = lv_obj_get_style_bg_opa(obj, 0);
-                if (bg_opa == LV_OPA_TRANSP) {
-                    // 这是用户或系统消息的容器
-                    bubble = lv_obj_get_child(obj, 0);
-                } else {
-                    // 这可能是助手消息的气泡自身
-                    bubble = obj;
-                }
-            } else {
-                // 没有子元素，可能是其他UI元素，跳过
-                continue;
-            }
-            
-            if (bubble == nullptr) continue;
-            
-            // 使用保存的用户数据来识别气泡类型
-            void* bubble_type_ptr = lv_obj_get_user_data(bubble);
-            if (bubble_type_ptr != nullptr) {
-                const char* bubble_type = static_cast<const char*>(bubble_type_ptr);
-                
-                // 根据气泡类型应用正确的颜色
-                if (strcmp(bubble_type, "user") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (strcmp(bubble_type, "assistant") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0); 
-                } else if (strcmp(bubble_type, "system") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                } else if (strcmp(bubble_type, "image") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 根据气泡类型设置文本颜色
-                        if (strcmp(bubble_type, "system") == 0) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            } else {
-                // 如果没有标记，回退到之前的逻辑（颜色比较）
-                // ...保留原有的回退逻辑...
-                lv_color_t bg_color = lv_obj_get_style_bg_color(bubble, 0);
-            
-                // 改进bubble类型检测逻辑，不仅使用颜色比较
-                bool is_user_bubble = false;
-                bool is_assistant_bubble = false;
-                bool is_system_bubble = false;
-            
-                // 检查用户bubble
-                if (lv_color_eq(bg_color, DARK_USER_BUBBLE_COLOR) || 
-                    lv_color_eq(bg_color, LIGHT_USER_BUBBLE_COLOR) ||
-                    lv_color_eq(bg_color, current_theme_.user_bubble)) {
-                    is_user_bubble = true;
-                }
-                // 检查系统bubble
-                else if (lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                         lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR) ||
-                         lv_color_eq(bg_color, current_theme_.system_bubble)) {
-                    is_system_bubble = true;
-                }
-                // 剩余的都当作助手bubble处理
-                else {
-                    is_assistant_bubble = true;
-                }
-            
-                // 根据bubble类型应用正确的颜色
-                if (is_user_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (is_assistant_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0);
-                } else if (is_system_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 回退到颜色检测逻辑
-                        if (lv_color_eq(bg_color, current_theme_.system_bubble) ||
-                            lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                            lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR)) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            }
-        }
-#else
-        // Simple UI mode - just update the main chat message
-        if (chat_message_label_ != nullptr) {
-            lv_obj_set_style_text_color(chat_message_label_, current_theme_.text, 0);
-        }
-        
-        if (emotion_label_ != nullptr) {
-            lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
+
+    {
+        DisplayLockGuard lock(this);
+#if CONFIG_USE_EMOTION_ATLAS
+        // The emoji glyphs were baked with the old text color, a tintable emoji font would keep it
+        if (!lv_color_eq(current_theme_.text, theme->text) && emotion_image_ != nullptr) {
+            emotion_atlas_.RecolorGlyphs(theme->text);
+            lv_obj_invalidate(emotion_image_);
         }
 #endif
-    }
-    
-    // Update low battery popup
-    if (low_battery_popup_ != nullptr) {
-        lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
+        current_theme_ = *theme;
+        UpdateThemeStyles();
     }
 
     // No errors occurred. Save theme to settings
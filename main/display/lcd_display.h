@@ -2,12 +2,15 @@
 #define LCD_DISPLAY_H
 
 #include "display.h"
+#include "chat_history.h"
+#include "emotion_atlas.h"
 
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
 #include <font_emoji.h>
 
 #include <atomic>
+#include <vector>
 
 // Theme color structure
 struct ThemeColors {
@@ -22,6 +25,51 @@ struct ThemeColors {
     lv_color_t low_battery;
 };
 
+// Themed surfaces, each one is a shared style attached when the widget is created
+enum ThemeStyle {
+    kThemeStyleScreen,      // background + text
+    kThemeStyleContainer,   // background + border
+    kThemeStyleStatusBar,   // background + text
+    kThemeStyleContent,     // chat background + border
+    kThemeStyleText,        // labels
+    kThemeStyleLowBattery,  // low battery popup
+    kThemeStyleCount
+};
+
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+// Only the visible bubbles are LVGL objects, older messages are kept as text in ChatHistory
+#if CONFIG_IDF_TARGET_ESP32P4
+#define CHAT_VISIBLE_MESSAGES 12
+#else
+#define CHAT_VISIBLE_MESSAGES 8
+#endif
+#define CHAT_HISTORY_CAPACITY (8 * 1024)
+#define CHAT_HISTORY_MAX_ENTRIES 64
+#define CHAT_MAX_IMAGE_BUBBLES 2
+// Text arena of each pooled bubble, streamed text beyond it continues in a new bubble
+#define CHAT_BUBBLE_TEXT_CAPACITY 1024
+
+enum ChatRole : uint8_t {
+    kChatRoleUser,
+    kChatRoleAssistant,
+    kChatRoleSystem,
+    kChatRoleCount
+};
+#endif
+
+// LVGL draw buffer strategies, each panel has a default that boards or Kconfig can override
+enum LcdBufferStrategy {
+    kLcdBufferDefault,
+    kLcdBufferLines,            // one DMA buffer of some lines
+    kLcdBufferDoubleLines,      // two DMA buffers, render while the other one is transferred
+    kLcdBufferPsramFullFrame,   // full frame in PSRAM, flushed through a DMA bounce buffer
+    kLcdBufferDirect,           // full frame buffers, only the changed areas are redrawn
+};
+
+struct LcdBufferConfig {
+    LcdBufferStrategy strategy = kLcdBufferDefault;
+    int lines = 0;
+};
 
 class LcdDisplay : public Display {
 protected:
@@ -34,29 +82,93 @@ protected:
     lv_obj_t* container_ = nullptr;
     lv_obj_t* side_bar_ = nullptr;
     lv_obj_t* preview_image_ = nullptr;
+    std::unique_ptr<PreviewImage> preview_data_;
 
     DisplayFonts fonts_;
     ThemeColors current_theme_;
+    // Built-in light/dark first, then the themes defined in NVS
+    std::vector<std::pair<std::string, ThemeColors>> themes_;
+    // A theme switch only updates these and reports one style change
+    lv_style_t theme_styles_[kThemeStyleCount];
 
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    // A pooled message row: full width row -> bubble -> label, re-skinned by role
+    struct ChatRow {
+        lv_obj_t* row = nullptr;
+        lv_obj_t* bubble = nullptr;
+        lv_obj_t* label = nullptr;
+        int role = -1;
+        char* text = nullptr;       // static text of the label
+        size_t text_length = 0;
+        lv_coord_t text_width = 0;  // single line width, only grows while streaming
+    };
+    std::vector<ChatRow> chat_rows_;
+    char* chat_text_arena_ = nullptr;
+    size_t chat_row_first_ = 0;     // oldest row in display order
+    size_t chat_rows_used_ = 0;
+    size_t chat_window_end_ = 0;    // history index after the newest bound row
+    ChatHistory chat_history_{CHAT_HISTORY_CAPACITY, CHAT_HISTORY_MAX_ENTRIES};
+    std::vector<lv_obj_t*> image_bubbles_;
+
+    // Shared by all bubbles, updated together with the theme styles
+    lv_style_t chat_row_style_;
+    lv_style_t chat_row_role_styles_[kChatRoleCount];
+    lv_style_t chat_bubble_style_;
+    lv_style_t chat_bubble_role_styles_[kChatRoleCount];
+    lv_style_t chat_text_style_;
+
+    void InitChatStyles();
+    void UpdateChatStyles();
+    ChatRow& AcquireChatRow();
+    void BindChatRow(ChatRow& row, uint8_t role, const char* text);
+    bool AppendChatRow(ChatRow& row, const char* delta);
+    void ShowChatHistory(size_t end);
+    static void OnChatScrollEnd(lv_event_t* e);
+#endif
+
+#if CONFIG_USE_EMOTION_ATLAS
+    // Emotions are shown from the atlas, emotion_label_ stays for icons and missing emotions
+    EmotionAtlas emotion_atlas_;
+    lv_obj_t* emotion_image_ = nullptr;
+    lv_timer_t* emotion_timer_ = nullptr;
+    const EmotionAtlas::Entry* emotion_entry_ = nullptr;
+    size_t emotion_frame_ = 0;
+
+    void InitEmotionAtlas();
+    bool ShowEmotionImage(const EmotionAtlas::Entry* entry);
+#endif
+
+    void LoadThemes();
+    const ThemeColors* FindTheme(const std::string& theme_name) const;
+    void InitThemeStyles();
+    void UpdateThemeStyles();
     void SetupUI();
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
 
+    virtual void SetEmotionImpl(const char* emotion) override;
+    virtual void SetIconImpl(const char* icon) override;
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    virtual void SetChatMessageImpl(const char* role, const char* content) override;
+    virtual void AppendChatMessageImpl(const char* role, const char* delta) override;
+#endif
+
 protected:
     // 添加protected构造函数
     LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel, DisplayFonts fonts, int width, int height);
     
 public:
     ~LcdDisplay();
-    virtual void SetEmotion(const char* emotion) override;
-    virtual void SetIcon(const char* icon) override;
-    virtual void SetPreviewImage(const lv_img_dsc_t* img_dsc) override;
-#if CONFIG_USE_WECHAT_MESSAGE_STYLE
-    virtual void SetChatMessage(const char* role, const char* content) override; 
-#endif  
+    virtual void SetPreviewImage(std::unique_ptr<PreviewImage> image) override;
 
     // Add theme switching function
     virtual void SetTheme(const std::string& theme_name) override;
+    // Register or replace a theme, boards may add their own before SetTheme
+    void AddTheme(const std::string& theme_name, const ThemeColors& colors);
+#if CONFIG_USE_EMOTION_ATLAS
+    // Append an animation frame to an emotion, played after its pre-rendered glyph
+    void AddEmotionFrame(const char* emotion, const lv_image_dsc_t* image, uint32_t frame_duration_ms = 0);
+#endif
 };
 
 // RGB LCD显示器
@@ -65,7 +177,7 @@ public:
     RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                   int width, int height, int offset_x, int offset_y,
                   bool mirror_x, bool mirror_y, bool swap_xy,
-                  DisplayFonts fonts);
+                  DisplayFonts fonts, LcdBufferConfig buffer_config = {});
 };
 
 // MIPI LCD显示器
@@ -74,7 +186,7 @@ public:
     MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                    int width, int height, int offset_x, int offset_y,
                    bool mirror_x, bool mirror_y, bool swap_xy,
-                   DisplayFonts fonts);
+                   DisplayFonts fonts, LcdBufferConfig buffer_config = {});
 };
 
 // // SPI LCD显示器
@@ -83,7 +195,7 @@ public:
     SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                   int width, int height, int offset_x, int offset_y,
                   bool mirror_x, bool mirror_y, bool swap_xy,
-                  DisplayFonts fonts);
+                  DisplayFonts fonts, LcdBufferConfig buffer_config = {});
 };
 
 // QSPI LCD显示器
@@ -94,7 +94,7 @@ void OledDisplay::Unlock() {
     lvgl_port_unlock();
 }
 
-void OledDisplay::SetChatMessage(const char* role, const char* content) {
+void OledDisplay::SetChatMessageImpl(const char* role, const char* content) {
     DisplayLockGuard lock(this);
     if (chat_message_label_ == nullptr) {
         return;
@@ -116,6 +116,17 @@ void OledDisplay::SetChatMessage(const char* role, const char* content) {
     }
 }
 
+void OledDisplay::AppendChatMessageImpl(const char* role, const char* delta) {
+    DisplayLockGuard lock(this);
+    if (chat_message_label_ == nullptr) {
+        return;
+    }
+
+    std::string delta_str = delta;
+    std::replace(delta_str.begin(), delta_str.end(), '\n', ' ');
+    lv_label_ins_text(chat_message_label_, LV_LABEL_POS_LAST, delta_str.c_str());
+}
+
 void OledDisplay::SetupUI_128x64() {
     DisplayLockGuard lock(this);
 
@@ -223,6 +234,11 @@ void OledDisplay::SetupUI_128x64() {
     lv_obj_set_style_text_color(low_battery_label_, lv_color_white(), 0);
     lv_obj_center(low_battery_label_);
     lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+
+    StartCommandQueue();
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    StartBenchmark();
+#endif
 }
 
 void OledDisplay::SetupUI_128x32() {
@@ -305,5 +321,10 @@ void OledDisplay::SetupUI_128x32() {
     lv_anim_set_repeat_count(&a, LV_ANIM_REPEAT_INFINITE);
     lv_obj_set_style_anim(chat_message_label_, &a, LV_PART_MAIN);
     lv_obj_set_style_anim_duration(chat_message_label_, lv_anim_speed_clamped(60, 300, 60000), LV_PART_MAIN);
+
+    StartCommandQueue();
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    StartBenchmark();
+#endif
 }
 
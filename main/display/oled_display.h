@@ -26,12 +26,13 @@ private:
     void SetupUI_128x64();
     void SetupUI_128x32();
 
+    virtual void SetChatMessageImpl(const char* role, const char* content) override;
+    virtual void AppendChatMessageImpl(const char* role, const char* delta) override;
+
 public:
     OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel, int width, int height, bool mirror_x, bool mirror_y,
                 DisplayFonts fonts);
     ~OledDisplay();
-
-    virtual void SetChatMessage(const char* role, const char* content) override;
 };
 
 #endif // OLED_DISPLAY_H
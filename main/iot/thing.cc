@@ -1,4 +1,5 @@
 #include "thing.h"
+#include "thing_manager.h"
 #include "application.h"
 
 #include <esp_log.h>
@@ -45,11 +46,30 @@ std::string Thing::GetDescriptorJson() {
 }
 
 std::string Thing::GetStateJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"state\":" + properties_.GetStateJson();
-    json_str += "}";
-    return json_str;
+    RefreshState();
+    return state_json_;
+}
+
+bool Thing::RefreshState() {
+    if (!properties_.Refresh() && state_version_ != 0) {
+        return false;
+    }
+    state_version_++;
+    state_json_ = "{";
+    state_json_ += "\"name\":\"" + name_ + "\",";
+    state_json_ += "\"state\":" + properties_.GetStateJson();
+    state_json_ += "}";
+    return true;
+}
+
+void Thing::NotifyPropertyChanged(const std::string& property_name) {
+    auto property = properties_.Find(property_name);
+    if (property == nullptr) {
+        ESP_LOGE(TAG, "Property not found: %s", property_name.c_str());
+        return;
+    }
+    property->MarkChanged();
+    ThingManager::GetInstance().NotifyStateChanged();
 }
 
 void Thing::Invoke(const cJSON* command) {
@@ -6,6 +6,7 @@
 #include <functional>
 #include <vector>
 #include <stdexcept>
+#include <atomic>
 #include <cJSON.h>
 
 namespace iot {
@@ -16,6 +17,8 @@ enum ValueType {
     kValueTypeString
 };
 
+// An observed property is only read again after MarkChanged(), the others are polled
+// and compared by value. The state JSON is rebuilt only when the value changed.
 class Property {
 private:
     std::string name_;
@@ -24,18 +27,67 @@ private:
     std::function<bool()> boolean_getter_;
     std::function<int()> number_getter_;
     std::function<std::string()> string_getter_;
+    bool observed_ = false;
+    // Bumped by MarkChanged() from any task, read by Refresh() on the main task
+    std::atomic<uint32_t> version_ = 1;
+    uint32_t read_version_ = 0;
+    // Last value read
+    bool boolean_ = false;
+    int number_ = 0;
+    std::string string_;
+    std::string state_json_;
 
 public:
-    Property(const std::string& name, const std::string& description, std::function<bool()> getter) :
-        name_(name), description_(description), type_(kValueTypeBoolean), boolean_getter_(getter) {}
-    Property(const std::string& name, const std::string& description, std::function<int()> getter) :
-        name_(name), description_(description), type_(kValueTypeNumber), number_getter_(getter) {}
-    Property(const std::string& name, const std::string& description, std::function<std::string()> getter) :
-        name_(name), description_(description), type_(kValueTypeString), string_getter_(getter) {}
+    Property(const std::string& name, const std::string& description, std::function<bool()> getter, bool observed = false) :
+        name_(name), description_(description), type_(kValueTypeBoolean), boolean_getter_(getter), observed_(observed) {}
+    Property(const std::string& name, const std::string& description, std::function<int()> getter, bool observed = false) :
+        name_(name), description_(description), type_(kValueTypeNumber), number_getter_(getter), observed_(observed) {}
+    Property(const std::string& name, const std::string& description, std::function<std::string()> getter, bool observed = false) :
+        name_(name), description_(description), type_(kValueTypeString), string_getter_(getter), observed_(observed) {}
+    // Properties are only copied while the thing is being set up
+    Property(const Property& other) :
+        name_(other.name_), description_(other.description_), type_(other.type_),
+        boolean_getter_(other.boolean_getter_), number_getter_(other.number_getter_), string_getter_(other.string_getter_),
+        observed_(other.observed_), version_(other.version_.load(std::memory_order_relaxed)), read_version_(other.read_version_),
+        boolean_(other.boolean_), number_(other.number_), string_(other.string_), state_json_(other.state_json_) {}
 
     const std::string& name() const { return name_; }
     const std::string& description() const { return description_; }
     ValueType type() const { return type_; }
+    const std::string& state_json() const { return state_json_; }
+
+    void MarkChanged() { version_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Returns true if the value differs from the last one read
+    bool Refresh() {
+        uint32_t version = version_.load(std::memory_order_relaxed);
+        if (observed_ && read_version_ == version) {
+            return false;
+        }
+        bool first = read_version_ == 0;
+        read_version_ = version;
+        if (type_ == kValueTypeBoolean) {
+            bool value = boolean_getter_();
+            if (!first && value == boolean_) {
+                return false;
+            }
+            boolean_ = value;
+        } else if (type_ == kValueTypeNumber) {
+            int value = number_getter_();
+            if (!first && value == number_) {
+                return false;
+            }
+            number_ = value;
+        } else if (type_ == kValueTypeString) {
+            std::string value = string_getter_();
+            if (!first && value == string_) {
+                return false;
+            }
+            string_ = std::move(value);
+        }
+        state_json_ = GetStateJson();
+        return true;
+    }
 
     bool boolean() const { return boolean_getter_(); }
     int number() const { return number_getter_(); }
@@ -55,13 +107,14 @@ public:
         return json_str;
     }
 
+    // From the last value read, see Refresh()
     std::string GetStateJson() {
         if (type_ == kValueTypeBoolean) {
-            return boolean_getter_() ? "true" : "false";
+            return boolean_ ? "true" : "false";
         } else if (type_ == kValueTypeNumber) {
-            return std::to_string(number_getter_());
+            return std::to_string(number_);
         } else if (type_ == kValueTypeString) {
-            return "\"" + string_getter_() + "\"";
+            return "\"" + string_ + "\"";
         }
         return "null";
     }
@@ -75,14 +128,33 @@ public:
     PropertyList() = default;
     PropertyList(const std::vector<Property>& properties) : properties_(properties) {}
 
-    void AddBooleanProperty(const std::string& name, const std::string& description, std::function<bool()> getter) {
-        properties_.push_back(Property(name, description, getter));
+    // observed: the thing calls Thing::NotifyPropertyChanged() on every change, so the getter is not polled
+    void AddBooleanProperty(const std::string& name, const std::string& description, std::function<bool()> getter, bool observed = false) {
+        properties_.push_back(Property(name, description, getter, observed));
     }
-    void AddNumberProperty(const std::string& name, const std::string& description, std::function<int()> getter) {
-        properties_.push_back(Property(name, description, getter));
+    void AddNumberProperty(const std::string& name, const std::string& description, std::function<int()> getter, bool observed = false) {
+        properties_.push_back(Property(name, description, getter, observed));
     }
-    void AddStringProperty(const std::string& name, const std::string& description, std::function<std::string()> getter) {
-        properties_.push_back(Property(name, description, getter));
+    void AddStringProperty(const std::string& name, const std::string& description, std::function<std::string()> getter, bool observed = false) {
+        properties_.push_back(Property(name, description, getter, observed));
+    }
+
+    Property* Find(const std::string& name) {
+        for (auto& property : properties_) {
+            if (property.name() == name) {
+                return &property;
+            }
+        }
+        return nullptr;
+    }
+
+    // Returns true if any property changed
+    bool Refresh() {
+        bool changed = false;
+        for (auto& property : properties_) {
+            changed |= property.Refresh();
+        }
+        return changed;
     }
 
     const Property& operator[](const std::string& name) const {
@@ -109,7 +181,7 @@ public:
     std::string GetStateJson() {
         std::string json_str = "{";
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetStateJson() + ",";
+            json_str += "\"" + property.name() + "\":" + property.state_json() + ",";
         }
         if (json_str.back() == ',') {
             json_str.pop_back();
@@ -270,8 +342,16 @@ public:
     virtual std::string GetStateJson();
     virtual void Invoke(const cJSON* command);
 
+    // Read the properties, returns true and bumps state_version() if any changed
+    bool RefreshState();
+    // For observed properties, may be called from any task
+    void NotifyPropertyChanged(const std::string& property_name);
+
     const std::string& name() const { return name_; }
     const std::string& description() const { return description_; }
+    uint32_t state_version() const { return state_version_; }
+    // From the last RefreshState()
+    const std::string& state_json() const { return state_json_; }
 
 protected:
     PropertyList properties_;
@@ -280,6 +360,8 @@ protected:
 private:
     std::string name_;
     std::string description_;
+    std::string state_json_;
+    uint32_t state_version_ = 0;
 };
 
 
@@ -1,4 +1,5 @@
 #include "thing_manager.h"
+#include "application.h"
 
 #include <esp_log.h>
 
@@ -7,13 +8,54 @@
 namespace iot {
 
 void ThingManager::AddThing(Thing* thing) {
+    if (thing == nullptr) {
+        return;
+    }
     things_.push_back(thing);
+    descriptors_.push_back(thing->GetDescriptorJson());
+
+#if CONFIG_IOT_STATES_PUSH_DELAY_MS > 0
+    if (push_timer_ == nullptr) {
+        esp_timer_create_args_t push_timer_args = {
+            .callback = [](void* arg) {
+                auto& app = Application::GetInstance();
+                app.Schedule([&app]() {
+                    app.UpdateIotStates();
+                });
+            },
+            .arg = nullptr,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "iot_states_push",
+            .skip_unhandled_events = true,
+        };
+        esp_timer_create(&push_timer_args, &push_timer_);
+    }
+#endif
+}
+
+void ThingManager::NotifyStateChanged() {
+#if CONFIG_IOT_STATES_PUSH_DELAY_MS > 0
+    if (push_timer_ != nullptr) {
+        // Restart the timer so a burst of changes is sent once
+        esp_timer_stop(push_timer_);
+        esp_timer_start_once(push_timer_, CONFIG_IOT_STATES_PUSH_DELAY_MS * 1000);
+    }
+#endif
+}
+
+void ThingManager::NotifyPropertyChanged(const std::string& thing_name, const std::string& property_name) {
+    for (auto thing : things_) {
+        if (thing->name() == thing_name) {
+            thing->NotifyPropertyChanged(property_name);
+            return;
+        }
+    }
 }
 
 std::string ThingManager::GetDescriptorsJson() {
     std::string json_str = "[";
-    for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+    for (auto& descriptor : descriptors_) {
+        json_str += descriptor + ",";
     }
     if (json_str.back() == ',') {
         json_str.pop_back();
@@ -24,24 +66,24 @@ std::string ThingManager::GetDescriptorsJson() {
 
 bool ThingManager::GetStatesJson(std::string& json, bool delta) {
     if (!delta) {
-        last_states_.clear();
+        reported_versions_.clear();
     }
+    reported_versions_.resize(things_.size(), 0);
     bool changed = false;
     json = "[";
-    // 枚举thing，获取每个thing的state，如果发生变化，则更新，保存到last_states_
+    // 枚举thing，只有属性变化时才重新生成state，state_version与上次发送时不同即为变化
     // 如果delta为true，则只返回变化的部分
-    for (auto& thing : things_) {
-        std::string state = thing->GetStateJson();
+    for (size_t i = 0; i < things_.size(); i++) {
+        auto thing = things_[i];
+        thing->RefreshState();
         if (delta) {
-            // 如果delta为true，则只返回变化的部分
-            auto it = last_states_.find(thing->name());
-            if (it != last_states_.end() && it->second == state) {
+            if (reported_versions_[i] == thing->state_version()) {
                 continue;
             }
             changed = true;
-            last_states_[thing->name()] = state;
+            reported_versions_[i] = thing->state_version();
         }
-        json += state + ",";
+        json += thing->state_json() + ",";
     }
     if (json.back() == ',') {
         json.pop_back();
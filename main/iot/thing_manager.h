@@ -5,6 +5,7 @@
 #include "thing.h"
 
 #include <cJSON.h>
+#include <esp_timer.h>
 
 #include <vector>
 #include <memory>
@@ -25,15 +26,24 @@ public:
     void AddThing(Thing* thing);
 
     std::string GetDescriptorsJson();
+    // One descriptor per thing, serialized once in AddThing since descriptors never change
+    const std::vector<std::string>& GetDescriptors() const { return descriptors_; }
     bool GetStatesJson(std::string& json, bool delta = false);
     void Invoke(const cJSON* command);
 
+    // A property changed, the changed states are pushed after CONFIG_IOT_STATES_PUSH_DELAY_MS
+    void NotifyStateChanged();
+    void NotifyPropertyChanged(const std::string& thing_name, const std::string& property_name);
+
 private:
     ThingManager() = default;
     ~ThingManager() = default;
 
     std::vector<Thing*> things_;
-    std::map<std::string, std::string> last_states_;
+    std::vector<std::string> descriptors_;
+    // state_version() of each thing when it was last sent, 0 for never
+    std::vector<uint32_t> reported_versions_;
+    esp_timer_handle_t push_timer_ = nullptr;
 };
 
 
@@ -24,7 +24,7 @@ public:
             // 这里可以添加获取当前亮度的逻辑
             auto backlight = Board::GetInstance().GetBacklight();
             return backlight ? backlight->brightness() : 100;
-        });
+        }, true);   // Application 在亮度渐变结束时通知
 
         // 定义设备可以被远程执行的指令
         methods_.AddMethod("set_theme", "Set the screen theme", ParameterList({
@@ -16,7 +16,7 @@ public:
         properties_.AddNumberProperty("volume", "Current audio volume value", [this]() -> int {
             auto codec = Board::GetInstance().GetAudioCodec();
             return codec->output_volume();
-        });
+        }, true);   // Application 在音量变化时通知
 
         // 定义设备可以被远程执行的指令
         methods_.AddMethod("set_volume", "Set the audio volume", ParameterList({
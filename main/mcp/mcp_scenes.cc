@@ -0,0 +1,160 @@
+#include "mcp_scenes.h"
+#include "mcp_server.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "McpScenes"
+
+McpScenes::~McpScenes() {
+    Clear();
+}
+
+void McpScenes::Clear() {
+    // The steps point into root_, drop them first
+    scenes_.clear();
+    if (root_ != nullptr) {
+        cJSON_Delete(root_);
+        root_ = nullptr;
+    }
+}
+
+// A step fails when the tool throws, returns false or returns a {"success": false} object, see README.
+// Any other text is a result, whatever it says.
+static bool IsFailure(const ReturnValue& value, std::string& message) {
+    if (std::holds_alternative<bool>(value)) {
+        if (std::get<bool>(value)) {
+            return false;
+        }
+        message = "returned false";
+        return true;
+    }
+    if (!std::holds_alternative<std::string>(value)) {
+        return false;
+    }
+    auto& text = std::get<std::string>(value);
+    if (text.empty() || text[0] != '{') {
+        return false;
+    }
+    auto json = cJSON_Parse(text.c_str());
+    bool failed = cJSON_IsFalse(cJSON_GetObjectItem(json, "success"));
+    if (failed) {
+        auto error = cJSON_GetObjectItem(json, "message");
+        message = cJSON_IsString(error) ? error->valuestring : text;
+    }
+    cJSON_Delete(json);
+    return failed;
+}
+
+bool McpScenes::Load() {
+    std::string json;
+    {
+        Settings settings("mcp", false);
+        json = settings.GetString("scenes");
+    }
+    Clear();
+    if (json.empty()) {
+        return false;
+    }
+    root_ = cJSON_Parse(json.c_str());
+    if (!cJSON_IsObject(root_)) {
+        ESP_LOGE(TAG, "Invalid scenes config");
+        Clear();
+        return false;
+    }
+
+    // Parse once, a run only walks the steps
+    cJSON* scene;
+    cJSON_ArrayForEach(scene, root_) {
+        if (!cJSON_IsArray(scene)) {
+            ESP_LOGW(TAG, "Scene %s is not an array of steps", scene->string);
+            continue;
+        }
+        std::vector<Step> steps;
+        cJSON* item;
+        cJSON_ArrayForEach(item, scene) {
+            auto tool = cJSON_GetObjectItem(item, "tool");
+            auto delay_ms = cJSON_GetObjectItem(item, "delay_ms");
+            if (cJSON_IsString(tool)) {
+                steps.push_back({
+                    .tool = tool->valuestring,
+                    .tool_hash = HashName(tool->valuestring),
+                    .arguments = cJSON_GetObjectItem(item, "arguments"),
+                });
+            } else if (cJSON_IsNumber(delay_ms)) {
+                steps.push_back({.delay_ms = delay_ms->valueint});
+            } else {
+                ESP_LOGW(TAG, "Scene %s: invalid step skipped", scene->string);
+            }
+        }
+        ESP_LOGI(TAG, "Scene %s: %u steps", scene->string, steps.size());
+        scenes_[scene->string] = std::move(steps);
+    }
+    return !scenes_.empty();
+}
+
+std::vector<std::string> McpScenes::GetNames() const {
+    std::vector<std::string> names;
+    for (auto& scene : scenes_) {
+        names.push_back(scene.first);
+    }
+    return names;
+}
+
+std::string McpScenes::Run(const std::string& name) {
+    auto scene = scenes_.find(name);
+    if (scene == scenes_.end()) {
+        return "{\"success\": false, \"message\": \"Unknown scene\"}";
+    }
+
+    // Device tools return as soon as their work is started (motors and lights run on their own tasks),
+    // so consecutive actions run together and a delay step orders them.
+    // The first failed step stops the scene, the later steps usually depend on it.
+    auto start_time = esp_timer_get_time();
+    auto& server = McpServer::GetInstance();
+    int actions = 0;
+    std::string failure;
+    for (auto& step : scene->second) {
+        if (step.tool == nullptr) {
+            vTaskDelay(pdMS_TO_TICKS(step.delay_ms));
+            continue;
+        }
+        auto tool = server.FindTool(NameKey(step.tool, step.tool_hash));
+        std::string error;
+        if (tool == nullptr) {
+            error = "unknown tool";
+        } else if (tool->stack() != kMcpToolStackDefault || tool->name() == "self.scene.run") {
+            error = "not allowed in a scene";
+        } else if (auto invocation = tool->Bind(step.arguments, error)) {
+            try {
+                if (!IsFailure(invocation(), error)) {
+                    error.clear();
+                    actions++;
+                }
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+        }
+        if (!error.empty()) {
+            ESP_LOGW(TAG, "Scene %s: %s: %s", name.c_str(), step.tool, error.c_str());
+            failure = std::string(step.tool) + ": " + error;
+            break;
+        }
+    }
+    ESP_LOGI(TAG, "Scene %s: %d actions in %ld ms", name.c_str(), actions, (long)((esp_timer_get_time() - start_time) / 1000));
+
+    cJSON* result = cJSON_CreateObject();
+    cJSON_AddBoolToObject(result, "success", failure.empty());
+    cJSON_AddNumberToObject(result, "actions", actions);
+    if (!failure.empty()) {
+        cJSON_AddStringToObject(result, "message", failure.c_str());
+    }
+    auto json_str = cJSON_PrintUnformatted(result);
+    std::string result_str(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(result);
+    return result_str;
+}
@@ -0,0 +1,38 @@
+#ifndef MCP_SCENES_H
+#define MCP_SCENES_H
+
+#include <cJSON.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+// 场景: 保存在 NVS 中的一组本地工具调用, 一次 self.scene.run 执行完, 不再逐个经过云端
+// NVS "mcp" / "scenes": {"good_night": [{"tool": "self.lamp_bar.control", "arguments": {"action": "stop_flow"}}, {"delay_ms": 500}, ...]}
+class McpScenes {
+public:
+    McpScenes() = default;
+    ~McpScenes();
+    McpScenes(const McpScenes&) = delete;
+    McpScenes& operator=(const McpScenes&) = delete;
+
+    // Returns false if no scene is configured, a reload replaces the scenes loaded before
+    bool Load();
+    std::vector<std::string> GetNames() const;
+    // Returns a JSON object with the outcome, runs on a tool worker and stops at the first failed step
+    std::string Run(const std::string& name);
+
+private:
+    struct Step {
+        const char* tool = nullptr;     // nullptr for a delay
+        uint32_t tool_hash = 0;
+        const cJSON* arguments = nullptr;
+        int delay_ms = 0;
+    };
+    std::map<std::string, std::vector<Step>> scenes_;
+    cJSON* root_ = nullptr;     // owns the tool names and arguments of the steps
+
+    void Clear();
+};
+
+#endif // MCP_SCENES_H
@@ -29,11 +29,10 @@ namespace mcp_tools
                 "参数说明：\n"
                 "- content：要展示的代码内容，必须为markdown格式，才能正常渲染。\n"
                 ,
-                PropertyList({
-                    Property("content", kPropertyTypeString),
-                }),
-                [this](const PropertyList& properties) -> ReturnValue {
-                    std::string content = properties["content"].value<std::string>();
+                McpArgs(
+                    McpArg<std::string>("content")
+                ),
+                [this](const std::string& content) -> ReturnValue {
                     if (!content.empty()) {
                         forward_chat_message("moss", content.c_str(), "markdown");
                         return "已推送到Web端";
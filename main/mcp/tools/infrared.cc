@@ -135,13 +135,11 @@ public:
             "4. 获取红外遥控器状态：action=\"get_status\"，无需 command 参数。\n"
             "注意：所有参数区分大小写，command 必须为字符串类型。\n"
             ,
-            PropertyList({
-                Property("action", kPropertyTypeString),
-                Property("command", kPropertyTypeString, "")
-            }),
-            [this](const PropertyList& properties) -> ReturnValue {
-                auto action = properties["action"].value<std::string>();
-                auto command = properties["command"].value<std::string>();
+            McpArgs(
+                McpArg<std::string>("action"),
+                McpArg<std::string>("command", "")
+            ),
+            [this](const std::string& action, std::string command) -> ReturnValue {
 
                 ESP_LOGI(TAG, "红外控制参数: command=%s, action=%s", command.c_str(), action.c_str());
 
@@ -101,11 +101,10 @@ void LampBarTool::Register() {
         "- action='stop_flow'：关闭流水灯效果\n"
         "- action='get_status'：获取流水灯当前状态信息\n"
         ,
-        PropertyList({
-            Property("action", kPropertyTypeString)
-        }),
-        [this](const PropertyList& properties) -> ReturnValue {
-            auto action = properties["action"].value<std::string>();
+        McpArgs(
+            McpArg<std::string>("action")
+        ),
+        [this](const std::string& action) -> ReturnValue {
             if (action == "start_flow") {
                 if(!flowing_) {
                     flowing_ = true;
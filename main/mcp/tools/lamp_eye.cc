@@ -104,12 +104,11 @@ void LampEyeTool::Register() {
         "- action='stop_breathing'：关闭呼吸灯光效果\n"
         "- action='get_status'：获取呼吸灯当前状态信息\n"
         ,
-        PropertyList({
-            Property("action", kPropertyTypeString),
-            Property("power", kPropertyTypeBoolean, false)
-        }),
-        [this](const PropertyList& properties) -> ReturnValue {
-            auto action = properties["action"].value<std::string>();
+        McpArgs(
+            McpArg<std::string>("action"),
+            McpArg<bool>("power", false)
+        ),
+        [this](const std::string& action, bool power) -> ReturnValue {
             if (action == "turn_on") {
                 power_ = true;
                 ledc_set_duty(LEDC_MODE, LEDC_CHANNEL, (1 << LEDC_DUTY_RES) - 1);
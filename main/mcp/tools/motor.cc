@@ -9,6 +9,9 @@
 
 #define STEPS_PER_REVOLUTION 512
 #define STEP_DELAY_MS 10
+// 转动结束后才回复，超过超时时间的转动仍立即回复
+#define MOTOR_TOOL_TIMEOUT_MS 60000
+#define MOTOR_PROGRESS_STEPS 64
 
 // 第一个电机 (Pitch / 俯仰)
 #define MOTOR_PIN_A ((gpio_num_t)13)
@@ -31,6 +34,7 @@ private:
         int direction;
         int steps;
         bool is_pitch;
+        McpToolCallId call;     // 0: the call was answered already
     };
 
     static const uint8_t phasecw[8];
@@ -87,6 +91,7 @@ private:
         int direction = args->direction;
         int steps = args->steps;
         bool is_pitch = args->is_pitch;
+        McpToolCallId call = args->call;
         delete args;
 
         const uint8_t *phase_seq = (direction == -1) ? phaseccw : phasecw;
@@ -99,11 +104,17 @@ private:
                     motor->set_motor2_phase(phase_seq[j]);
                 vTaskDelay(STEP_DELAY_MS / portTICK_PERIOD_MS);
             }
+            if (call != 0 && (i + 1) % MOTOR_PROGRESS_STEPS == 0) {
+                McpServer::GetInstance().NotifyProgress(call, i + 1, steps);
+            }
         }
         if (is_pitch)
             motor->set_motor_phase(0x00);
         else
             motor->set_motor2_phase(0x00);
+        if (call != 0) {
+            McpServer::GetInstance().CompleteToolCall(call, is_pitch ? "俯仰电机已转动到位" : "左右电机已转动到位");
+        }
         vTaskDelete(NULL);
     }
 
@@ -125,30 +136,38 @@ public:
             "参数说明：\n"
             "- motor：必填，取值为'pitch'或'yaw'\n"
             "- angle：必填，整型，表示旋转角度\n",
-            PropertyList({
-                Property("motor", kPropertyTypeString), // "pitch" or "yaw"
-                Property("angle", kPropertyTypeInteger) // 角度，正负
-            }),
-            [this](const PropertyList& properties) -> ReturnValue {
-                auto motor_type = properties["motor"].value<std::string>();
-                int angle = properties["angle"].value<int>();
+            McpArgs(
+                McpArg<std::string>("motor"),   // "pitch" or "yaw"
+                McpArg<int>("angle")            // 角度，正负
+            ),
+            [this](const std::string& motor_type, int angle) -> ReturnValue {
                 int direction = (angle > 0) ? 1 : -1;
                 int steps = (int)(fabs(angle) / 360.0 * STEPS_PER_REVOLUTION + 0.5);
 
-                if (motor_type == "pitch") {
-                    ESP_LOGI(TAG, "RotatePitch: %d° -> %d Steps", angle, steps);
-                    auto args = new TaskArgs{this, direction, steps, true};
-                    xTaskCreate(RotationTask, "PitchRot", 2048, args, 1, NULL);
-                    return "俯仰电机已执行";
-                } else if (motor_type == "yaw") {
-                    ESP_LOGI(TAG, "RotateYaw: %d° -> %d Steps", angle, steps);
-                    auto args = new TaskArgs{this, direction, steps, false};
-                    xTaskCreate(RotationTask, "YawRot", 2048, args, 1, NULL);
-                    return "左右电机已执行";
-                } else {
+                if (motor_type != "pitch" && motor_type != "yaw") {
                     return "未知电机类型: " + motor_type + "，请用 pitch 或 yaw";
                 }
-            }
+                bool is_pitch = motor_type == "pitch";
+                ESP_LOGI(TAG, "%s: %d° -> %d Steps", is_pitch ? "RotatePitch" : "RotateYaw", angle, steps);
+
+                // 转动结束时由 RotationTask 回复，服务器可以据此安排语音和动作的先后
+                McpToolCallId call = 0;
+                if (steps * 8 * STEP_DELAY_MS < MOTOR_TOOL_TIMEOUT_MS - 1000) {
+                    call = McpServer::GetInstance().DeferToolCall(name());
+                }
+                auto args = new TaskArgs{this, direction, steps, is_pitch, call};
+                // 回复和进度通知要生成 JSON 并发送, 需要和工具 worker 一样大的栈
+                uint32_t stack_size = call != 0 ? MCP_TOOL_STACK_SIZE_DEFAULT : 2048;
+                if (xTaskCreate(RotationTask, is_pitch ? "PitchRot" : "YawRot", stack_size, args, 1, NULL) != pdPASS) {
+                    delete args;
+                    if (call != 0) {
+                        McpServer::GetInstance().FailToolCall(call, "Failed to start the motor");
+                    }
+                    return "电机启动失败";
+                }
+                return is_pitch ? "俯仰电机已执行" : "左右电机已执行";
+            },
+            kMcpToolStackDefault, MOTOR_TOOL_TIMEOUT_MS
         );
     }
 };
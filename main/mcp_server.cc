@@ -8,7 +8,8 @@
 #include <esp_app_desc.h>
 #include <algorithm>
 #include <cstring>
-#include <esp_pthread.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
 
 #include "application.h"
 #include "display.h"
@@ -16,12 +17,86 @@
 
 #define TAG "MCP"
 
-#define DEFAULT_TOOLCALL_STACK_SIZE 6144
+McpToolInvocation McpTool::BindProperties(const PropertyList& properties,
+    const std::function<ReturnValue(const PropertyList&)>& callback, const cJSON* arguments, std::string& error) {
+    PropertyList values = properties;
+    try {
+        for (auto& argument : values) {
+            bool found = false;
+            if (cJSON_IsObject(arguments)) {
+                auto value = cJSON_GetObjectItem(arguments, argument.name().c_str());
+                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
+                    argument.set_value<bool>(value->valueint == 1);
+                    found = true;
+                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
+                    argument.set_value<int>(value->valueint);
+                    found = true;
+                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
+                    argument.set_value<std::string>(value->valuestring);
+                    found = true;
+                }
+            }
+
+            if (!argument.has_default_value() && !found) {
+                error = "Missing valid argument: " + argument.name();
+                return nullptr;
+            }
+        }
+    } catch (const std::exception& e) {
+        error = e.what();
+        return nullptr;
+    }
+    return [callback, values = std::move(values)]() {
+        return callback(values);
+    };
+}
+
+std::string McpTool::Call(const McpToolInvocation& invocation) {
+    return ToResult(invocation());
+}
+
+std::string McpTool::ToResult(const ReturnValue& return_value) {
+    // 返回结果
+    cJSON* result = cJSON_CreateObject();
+    cJSON* content = cJSON_CreateArray();
+    cJSON* text = cJSON_CreateObject();
+    cJSON_AddStringToObject(text, "type", "text");
+    if (std::holds_alternative<std::string>(return_value)) {
+        cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
+    } else if (std::holds_alternative<bool>(return_value)) {
+        cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
+    } else if (std::holds_alternative<int>(return_value)) {
+        cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
+    }
+    cJSON_AddItemToArray(content, text);
+    cJSON_AddItemToObject(result, "content", content);
+    cJSON_AddBoolToObject(result, "isError", false);
+
+    auto json_str = cJSON_PrintUnformatted(result);
+    std::string result_str(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(result);
+    return result_str;
+}
 
 McpServer::McpServer() {
+    esp_timer_create_args_t state_notify_args = {
+        .callback = [](void* arg) {
+            ((McpServer*)arg)->SendStateChanged();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mcp_state_notify",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&state_notify_args, &state_notify_timer_);
 }
 
 McpServer::~McpServer() {
+    if (state_notify_timer_ != nullptr) {
+        esp_timer_stop(state_notify_timer_);
+        esp_timer_delete(state_notify_timer_);
+    }
     for (auto tool : tools_) {
         delete tool;
     }
@@ -33,6 +108,8 @@ void McpServer::AddCommonTools() {
     // the tools list to utilize the prompt cache.
     // Backup the original tools list and restore it after adding the common tools.
     auto original_tools = std::move(tools_);
+    tools_.clear();
+    tools_index_.Clear();
     auto& board = Board::GetInstance();
 
     AddTool("self.get_device_status",
@@ -44,6 +121,8 @@ void McpServer::AddCommonTools() {
         [&board](const PropertyList& properties) -> ReturnValue {
             return board.GetDeviceStatusJson();
         });
+    // Called before nearly every control action, the battery and chip temperature are allowed to lag by the TTL
+    SetToolCache("self.get_device_status");
 
     AddTool("self.audio_speaker.set_volume", 
         "Set the volume of the audio speaker. If the current volume is unknown, you must call `self.get_device_status` tool first and then call this tool.",
@@ -73,12 +152,13 @@ void McpServer::AddCommonTools() {
     auto display = board.GetDisplay();
     if (display && !display->GetTheme().empty()) {
         AddTool("self.screen.set_theme",
-            "Set the theme of the screen. The theme can be `light` or `dark`.",
+            "Set the theme of the screen. The theme can be `light`, `dark` or a custom theme configured on the device.",
             PropertyList({
                 Property("theme", kPropertyTypeString)
             }),
             [display](const PropertyList& properties) -> ReturnValue {
                 display->SetTheme(properties["theme"].value<std::string>().c_str());
+                McpServer::GetInstance().NotifyStateChanged();
                 return true;
             });
     }
@@ -94,32 +174,58 @@ void McpServer::AddCommonTools() {
             PropertyList({
                 Property("question", kPropertyTypeString)
             }),
-            [camera](const PropertyList& properties) -> ReturnValue {
+            [this, camera](const PropertyList& properties) -> ReturnValue {
+                auto call = CurrentToolCall("self.camera.take_photo");
+                NotifyProgress(call, 0, 2, "Capturing photo");
                 if (!camera->Capture()) {
                     return "{\"success\": false, \"message\": \"Failed to capture photo\"}";
                 }
+                NotifyProgress(call, 1, 2, "Uploading photo and waiting for the explanation");
                 auto question = properties["question"].value<std::string>();
                 return camera->Explain(question);
-            });
+            }, kMcpToolStackLarge, 30000);
+    }
+
+    if (scenes_.Load()) {
+        std::string names;
+        for (auto& name : scenes_.GetNames()) {
+            names += (names.empty() ? "`" : ", `") + name + "`";
+        }
+        AddTool("self.scene.run",
+            "Run a scene configured on the device, which performs several device actions in one call.\n"
+            "Prefer this tool over calling the device tools one by one when the user's request matches a scene.\n"
+            "Available scenes: " + names,
+            McpArgs(McpArg<std::string>("name")),
+            [this](const std::string& name) -> ReturnValue {
+                return scenes_.Run(name);
+            }, kMcpToolStackDefault, 30000);
     }
 
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    tools_index_.Clear();
+    for (size_t i = 0; i < tools_.size(); i++) {
+        tools_index_.Add(tools_[i]->name_hash(), i);
+    }
+    tools_list_dirty_ = true;
 }
 
 void McpServer::AddTool(McpTool* tool) {
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (FindTool(NameKey(tool->name(), tool->name_hash())) != nullptr) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s", tool->name().c_str());
+    tools_index_.Add(tool->name_hash(), tools_.size());
     tools_.push_back(tool);
+    tools_list_dirty_ = true;
 }
 
-void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
-    AddTool(new McpTool(name, description, properties, callback));
+void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+    McpToolStack stack, int timeout_ms) {
+    AddTool(new McpTool(name, description, properties, callback, stack, timeout_ms));
 }
 
 void McpServer::ParseMessage(const std::string& message) {
@@ -152,6 +258,34 @@ void McpServer::ParseCapabilities(const cJSON* capabilities) {
 }
 
 void McpServer::ParseMessage(const cJSON* json) {
+    if (cJSON_IsArray(json)) {
+        ParseBatch(json);
+        return;
+    }
+    requests_++;
+    ParseRequest(json, nullptr);
+}
+
+// JSON-RPC batch: the requests run concurrently and their replies go back as one array
+void McpServer::ParseBatch(const cJSON* json) {
+    int size = cJSON_GetArraySize(json);
+    if (size == 0) {
+        ESP_LOGE(TAG, "Empty batch");
+        return;
+    }
+    batches_++;
+    requests_ += size;
+    auto batch = new McpBatch();
+    batch->start_time = esp_timer_get_time();
+    batch->size = size;
+    cJSON* item;
+    cJSON_ArrayForEach(item, json) {
+        ParseRequest(item, batch);
+    }
+    FinishBatchRequest(batch, true);
+}
+
+void McpServer::ParseRequest(const cJSON* json, McpBatch* batch) {
     // Check JSONRPC version
     auto version = cJSON_GetObjectItem(json, "jsonrpc");
     if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
@@ -168,6 +302,13 @@ void McpServer::ParseMessage(const cJSON* json) {
     
     auto method_str = std::string(method->valuestring);
     if (method_str.find("notifications") == 0) {
+        if (method_str == "notifications/cancelled") {
+            auto params = cJSON_GetObjectItem(json, "params");
+            auto request_id = cJSON_GetObjectItem(params, "requestId");
+            if (cJSON_IsNumber(request_id)) {
+                CancelToolCall(request_id->valueint);
+            }
+        }
         return;
     }
     
@@ -192,11 +333,12 @@ void McpServer::ParseMessage(const cJSON* json) {
                 ParseCapabilities(capabilities);
             }
         }
+        initialized_ = true;
         auto app_desc = esp_app_get_description();
         std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
         message += app_desc->version;
         message += "\"}}";
-        ReplyResult(id_int, message);
+        ReplyResult(id_int, message, batch);
     } else if (method_str == "tools/list") {
         std::string cursor_str = "";
         if (params != nullptr) {
@@ -205,163 +347,614 @@ void McpServer::ParseMessage(const cJSON* json) {
                 cursor_str = std::string(cursor->valuestring);
             }
         }
-        GetToolsList(id_int, cursor_str);
+        GetToolsList(id_int, cursor_str, batch);
     } else if (method_str == "tools/call") {
         if (!cJSON_IsObject(params)) {
             ESP_LOGE(TAG, "tools/call: Missing params");
-            ReplyError(id_int, "Missing params");
+            ReplyError(id_int, "Missing params", batch);
             return;
         }
         auto tool_name = cJSON_GetObjectItem(params, "name");
         if (!cJSON_IsString(tool_name)) {
             ESP_LOGE(TAG, "tools/call: Missing name");
-            ReplyError(id_int, "Missing name");
+            ReplyError(id_int, "Missing name", batch);
             return;
         }
         auto tool_arguments = cJSON_GetObjectItem(params, "arguments");
         if (tool_arguments != nullptr && !cJSON_IsObject(tool_arguments)) {
             ESP_LOGE(TAG, "tools/call: Invalid arguments");
-            ReplyError(id_int, "Invalid arguments");
+            ReplyError(id_int, "Invalid arguments", batch);
             return;
         }
         auto stack_size = cJSON_GetObjectItem(params, "stackSize");
         if (stack_size != nullptr && !cJSON_IsNumber(stack_size)) {
             ESP_LOGE(TAG, "tools/call: Invalid stackSize");
-            ReplyError(id_int, "Invalid stackSize");
+            ReplyError(id_int, "Invalid stackSize", batch);
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, stack_size ? stack_size->valueint : DEFAULT_TOOLCALL_STACK_SIZE);
+        // Echoed in notifications/progress as it came, a string or a number
+        std::string progress_token;
+        auto meta = cJSON_GetObjectItem(params, "_meta");
+        auto token = cJSON_IsObject(meta) ? cJSON_GetObjectItem(meta, "progressToken") : nullptr;
+        if (cJSON_IsString(token) || cJSON_IsNumber(token)) {
+            char* token_json = cJSON_PrintUnformatted(token);
+            progress_token = token_json;
+            cJSON_free(token_json);
+        }
+        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, stack_size ? stack_size->valueint : 0,
+            progress_token, batch);
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
-        ReplyError(id_int, "Method not implemented: " + method_str);
+        ReplyError(id_int, "Method not implemented: " + method_str, batch);
     }
 }
 
-void McpServer::ReplyResult(int id, const std::string& result) {
+void McpServer::ReplyResult(int id, const std::string& result, McpBatch* batch) {
     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
     payload += std::to_string(id) + ",\"result\":";
     payload += result;
     payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+    SendReply(std::move(payload), batch);
 }
 
-void McpServer::ReplyError(int id, const std::string& message) {
+void McpServer::ReplyError(int id, const std::string& message, McpBatch* batch) {
     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
     payload += std::to_string(id);
     payload += ",\"error\":{\"message\":\"";
     payload += message;
     payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+    SendReply(std::move(payload), batch);
 }
 
-void McpServer::GetToolsList(int id, const std::string& cursor) {
-    const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
-    
-    bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
-    std::string next_cursor = "";
-    
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
-                continue;
-            }
+void McpServer::SendReply(std::string&& payload, McpBatch* batch) {
+    if (batch == nullptr) {
+        reply_messages_++;
+        Application::GetInstance().SendMcpMessage(payload);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(batch_mutex_);
+    batch->replies.push_back(std::move(payload));
+}
+
+// Called once the batch is parsed and once per tool call of it that got answered or cancelled
+void McpServer::FinishBatchRequest(McpBatch* batch, bool parsed) {
+    std::unique_lock<std::mutex> lock(batch_mutex_);
+    if (parsed) {
+        batch->parsed = true;
+    } else {
+        batch->pending_calls--;
+    }
+    if (!batch->parsed || batch->pending_calls > 0) {
+        return;
+    }
+    lock.unlock();
+
+    ESP_LOGI(TAG, "Batch of %d requests answered with %u replies in %ld ms", batch->size, batch->replies.size(),
+        (long)((esp_timer_get_time() - batch->start_time) / 1000));
+    if (!batch->replies.empty()) {
+        std::string payload = "[";
+        for (auto& reply : batch->replies) {
+            payload += reply;
+            payload += ',';
+        }
+        payload.back() = ']';
+        reply_messages_++;
+        Application::GetInstance().SendMcpMessage(payload);
+    }
+    delete batch;
+}
+
+void McpServer::BuildToolsListPages() {
+    const size_t max_payload_size = 8000;
+    auto start_time = esp_timer_get_time();
+    tools_list_pages_.clear();
+
+    std::string json;
+    size_t i = 0;
+    while (i < tools_.size()) {
+        auto tool = tools_[i];
+        if (json.empty()) {
+            tools_list_pages_.push_back({tool->name(), ""});
+            json = "{\"tools\":[";
         }
-        
         // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
-            // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
-            break;
+        if (json.length() + tool->json().length() + 1 + 30 > max_payload_size) {
+            if (json.back() == '[') {
+                // The tool alone is too large, later tools cannot be listed either
+                ESP_LOGE(TAG, "tools/list: Tool %s exceeds the payload size limit", tool->name().c_str());
+                json.clear();
+                break;
+            }
+            json.pop_back();
+            json += "],\"nextCursor\":\"" + tool->name() + "\"}";
+            tools_list_pages_.back().json = std::move(json);
+            json.clear();
+            continue;
         }
-        
-        json += tool_json;
-        ++it;
+        json += tool->json();
+        json += ',';
+        i++;
     }
-    
-    if (json.back() == ',') {
+    if (tools_list_pages_.empty()) {
+        tools_list_pages_.push_back({"", "{\"tools\":[]}"});
+    } else if (!json.empty()) {
         json.pop_back();
+        json += "]}";
+        tools_list_pages_.back().json = std::move(json);
     }
-    
-    if (json.back() == '[' && !tools_.empty()) {
-        // 如果没有添加任何tool，返回错误
-        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
+    tools_list_dirty_ = false;
+    ESP_LOGI(TAG, "tools/list: %u tools in %u pages, built in %ld us", tools_.size(), tools_list_pages_.size(),
+        (long)(esp_timer_get_time() - start_time));
+}
+
+void McpServer::GetToolsList(int id, const std::string& cursor, McpBatch* batch) {
+    if (tools_list_dirty_) {
+        BuildToolsListPages();
+    }
+
+    auto page = tools_list_pages_.begin();
+    if (!cursor.empty()) {
+        page = std::find_if(tools_list_pages_.begin(), tools_list_pages_.end(), [&cursor](const ToolsListPage& p) {
+            return p.cursor == cursor;
+        });
+        if (page == tools_list_pages_.end()) {
+            ESP_LOGE(TAG, "tools/list: Invalid cursor %s", cursor.c_str());
+            ReplyError(id, "Invalid cursor: " + cursor, batch);
+            return;
+        }
+    }
+
+    if (page->json.empty()) {
+        ReplyError(id, "Failed to add tool " + page->cursor + " because of payload size limit", batch);
         return;
     }
+    ReplyResult(id, page->json, batch);
+}
 
-    if (next_cursor.empty()) {
-        json += "]}";
-    } else {
-        json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+McpTool* McpServer::FindTool(const NameKey& name) {
+    int id = tools_index_.Find(name, [this](size_t id) -> const std::string& { return tools_[id]->name(); });
+    return id >= 0 ? tools_[id] : nullptr;
+}
+
+void McpServer::SetToolCache(const std::string& name, int ttl_ms) {
+    auto tool = FindTool(name);
+    if (tool == nullptr || !tool->properties().empty()) {
+        ESP_LOGW(TAG, "Tool %s can not be cached", name.c_str());
+        return;
     }
-    
-    ReplyResult(id, json);
+    std::lock_guard<std::mutex> lock(tool_call_mutex_);
+    tool->cache() = {.ttl_ms = ttl_ms};
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+void McpServer::NotifyStateChanged() {
+    state_generation_++;
+    if (initialized_ && state_notify_timer_ != nullptr) {
+        // Restart the timer so a volume knob or a brightness fade sends one notification
+        esp_timer_stop(state_notify_timer_);
+        esp_timer_start_once(state_notify_timer_, MCP_STATE_NOTIFY_DELAY_MS * 1000);
+    }
+}
+
+void McpServer::SendStateChanged() {
+    std::string payload = "{\"jsonrpc\":\"2.0\",\"method\":\"notifications/tools/state_changed\",\"params\":{\"tools\":[";
+    bool empty = true;
+    for (auto tool : tools_) {
+        if (tool->cache().ttl_ms > 0) {
+            payload += (empty ? "\"" : ",\"") + tool->name() + "\"";
+            empty = false;
+        }
+    }
+    payload += "]}}";
+    if (!empty) {
+        Application::GetInstance().SendMcpMessage(payload);
+    }
+}
+
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size,
+    const std::string& progress_token, McpBatch* batch) {
+    auto tool = FindTool(tool_name);
+    if (tool == nullptr) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
-        ReplyError(id, "Unknown tool: " + tool_name);
+        ReplyError(id, "Unknown tool: " + tool_name, batch);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
-    try {
-        for (auto& argument : arguments) {
-            bool found = false;
-            if (cJSON_IsObject(tool_arguments)) {
-                auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
-                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
-                    argument.set_value<bool>(value->valueint == 1);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
-                    argument.set_value<int>(value->valueint);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
-                    argument.set_value<std::string>(value->valuestring);
-                    found = true;
-                }
-            }
+    // Answer read-only tools from the cached result, without a worker round trip
+    if (tool->cache().ttl_ms > 0) {
+        std::unique_lock<std::mutex> lock(tool_call_mutex_);
+        auto& cache = tool->cache();
+        if (!cache.result.empty() && cache.generation == state_generation_ && esp_timer_get_time() < cache.expire_time) {
+            auto result = cache.result;
+            tool->stats().cache_hits++;
+            lock.unlock();
+            ReplyResult(id, result, batch);
+            return;
+        }
+    }
 
-            if (!argument.has_default_value() && !found) {
-                ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                ReplyError(id, "Missing valid argument: " + argument.name());
-                return;
+    std::string error;
+    auto invocation = tool->Bind(tool_arguments, error);
+    if (!invocation) {
+        ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+        ReplyError(id, error, batch);
+        return;
+    }
+
+    // The server may still ask for a bigger stack than the tool declares
+    auto stack = tool->stack();
+    if (stack_size > MCP_TOOL_STACK_SIZE_DEFAULT) {
+        stack = kMcpToolStackLarge;
+    }
+    if (stack_size > MCP_TOOL_STACK_SIZE_LARGE) {
+        ESP_LOGW(TAG, "tools/call: stackSize %d is larger than the workers have", stack_size);
+    }
+    if (!StartToolWorkers()) {
+        ReplyError(id, "Failed to start tool workers", batch);
+        return;
+    }
+
+    auto call = new ToolCall();
+    call->id = id;
+    call->tool = tool;
+    call->invocation = std::move(invocation);
+    call->enqueue_time = esp_timer_get_time();
+    call->deadline = call->enqueue_time + tool->timeout_ms() * 1000LL;
+    call->batch = batch;
+    call->progress_token = progress_token;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        if (++last_call_id_ == 0) {
+            ++last_call_id_;
+        }
+        call->call_id = last_call_id_;
+        if (xQueueSend(tool_call_queues_[stack], &call, 0) != pdPASS) {
+            delete call;
+            ESP_LOGE(TAG, "tools/call: Too many pending calls, rejected %s", tool_name.c_str());
+            ReplyError(id, "Too many pending tool calls", batch);
+            return;
+        }
+        tool_calls_.push_back(call);
+        if (batch != nullptr) {
+            std::lock_guard<std::mutex> batch_lock(batch_mutex_);
+            batch->pending_calls++;
+        }
+        if (!tool_call_watchdog_running_) {
+            tool_call_watchdog_running_ = true;
+            esp_timer_start_periodic(tool_call_watchdog_, 500 * 1000);
+        }
+    }
+}
+
+bool McpServer::StartToolWorkers() {
+    if (tool_call_watchdog_ != nullptr) {
+        return true;
+    }
+    // Queues and the watchdog are created first and rolled back on failure, no worker waits on them yet.
+    // Once the watchdog exists the pools count as started, a worker that failed to start is not retried.
+    for (int i = 0; i < kMcpToolStackCount; i++) {
+        tool_call_queues_[i] = xQueueCreate(MCP_TOOL_QUEUE_SIZE, sizeof(ToolCall*));
+        if (tool_call_queues_[i] == nullptr) {
+            ESP_LOGE(TAG, "Failed to create tool call queue");
+            StopToolQueues();
+            return false;
+        }
+    }
+
+    esp_timer_create_args_t watchdog_args = {
+        .callback = [](void* arg) {
+            ((McpServer*)arg)->CheckToolCallDeadlines();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "tool_call_watchdog",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&watchdog_args, &tool_call_watchdog_) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create tool call watchdog");
+        tool_call_watchdog_ = nullptr;
+        StopToolQueues();
+        return false;
+    }
+
+    const struct {
+        uint32_t stack_size;
+        int workers;
+    } pools[kMcpToolStackCount] = {
+        {MCP_TOOL_STACK_SIZE_DEFAULT, MCP_TOOL_WORKERS_DEFAULT},
+        {MCP_TOOL_STACK_SIZE_LARGE, MCP_TOOL_WORKERS_LARGE},
+    };
+    for (int i = 0; i < kMcpToolStackCount; i++) {
+        int started = 0;
+        for (int j = 0; j < pools[i].workers; j++) {
+            auto args = new std::pair<McpServer*, McpToolStack>(this, (McpToolStack)i);
+            if (xTaskCreate([](void* arg) {
+                auto args = (std::pair<McpServer*, McpToolStack>*)arg;
+                auto server = args->first;
+                auto stack = args->second;
+                delete args;
+                server->ToolWorkerLoop(stack);
+                vTaskDelete(NULL);
+            }, "tool_call", pools[i].stack_size, args, 1, nullptr) != pdPASS) {
+                delete args;
+                ESP_LOGE(TAG, "Failed to create tool worker");
+            } else {
+                started++;
             }
         }
-    } catch (const std::runtime_error& e) {
-        ESP_LOGE(TAG, "tools/call: %s", e.what());
-        ReplyError(id, e.what());
-        return;
+        if (started == 0) {
+            // Calls queued here fail with a timeout from the watchdog
+            ESP_LOGE(TAG, "No tool worker with a %lu bytes stack", (unsigned long)pools[i].stack_size);
+        }
     }
+    return true;
+}
 
-    // Start a task to receive data with stack size
-    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
-    cfg.thread_name = "tool_call";
-    cfg.stack_size = stack_size;
-    cfg.prio = 1;
-    esp_pthread_set_cfg(&cfg);
+void McpServer::StopToolQueues() {
+    for (auto& queue : tool_call_queues_) {
+        if (queue != nullptr) {
+            vQueueDelete(queue);
+            queue = nullptr;
+        }
+    }
+}
+
+void McpServer::ToolWorkerLoop(McpToolStack stack) {
+    ToolCall* call;
+    while (xQueueReceive(tool_call_queues_[stack], &call, portMAX_DELAY) == pdPASS) {
+        RunToolCall(call);
+    }
+}
 
-    // Use a thread to call the tool to avoid blocking the main thread
-    tool_call_thread_ = std::thread([this, id, tool_iter, arguments = std::move(arguments)]() {
+void McpServer::RunToolCall(ToolCall* call) {
+    auto tool = call->tool;
+    auto start_time = esp_timer_get_time();
+    // A change while the tool runs makes its result stale already
+    uint32_t generation = state_generation_;
+    bool skipped = call->replied;
+    std::string result;
+    std::string error;
+    if (!skipped) {
+        {
+            std::lock_guard<std::mutex> lock(tool_call_mutex_);
+            call->worker = xTaskGetCurrentTaskHandle();
+        }
         try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
+            result = McpTool::Call(call->invocation);
         } catch (const std::runtime_error& e) {
-            ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+            error = e.what();
+        }
+    }
+    auto end_time = esp_timer_get_time();
+
+    bool deferred;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        call->worker = nullptr;
+        deferred = call->deferred && error.empty();
+    }
+    // The watchdog or a cancel may have answered already, a deferred call is answered by CompleteToolCall
+    if (deferred) {
+        ESP_LOGI(TAG, "tools/call: %s deferred", tool->name().c_str());
+    } else if (!call->replied.exchange(true)) {
+        if (error.empty()) {
+            ReplyResult(call->id, result, call->batch);
+        } else {
+            ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+            ReplyError(call->id, error, call->batch);
+        }
+        if (call->batch != nullptr) {
+            FinishBatchRequest(call->batch, false);
+        }
+    } else if (!skipped) {
+        ESP_LOGW(TAG, "tools/call: %s finished after %ld ms, result dropped", tool->name().c_str(),
+            (long)((end_time - start_time) / 1000));
+    }
+
+    std::lock_guard<std::mutex> lock(tool_call_mutex_);
+    auto& stats = tool->stats();
+    stats.calls++;
+    stats.max_wait_us = std::max(stats.max_wait_us, start_time - call->enqueue_time);
+    stats.total_run_us += end_time - start_time;
+    stats.max_run_us = std::max(stats.max_run_us, end_time - start_time);
+    auto& cache = tool->cache();
+    if (cache.ttl_ms > 0 && !skipped && !deferred && error.empty()) {
+        cache.result = std::move(result);
+        cache.expire_time = end_time + cache.ttl_ms * 1000LL;
+        cache.generation = generation;
+    }
+    call->returned = true;
+    if (call->replied) {
+        FinishToolCall(call);
+    }
+}
+
+// Call with tool_call_mutex_ held
+void McpServer::FinishToolCall(ToolCall* call) {
+    tool_calls_.remove(call);
+    delete call;
+    if (tool_calls_.empty() && tool_call_watchdog_running_) {
+        tool_call_watchdog_running_ = false;
+        esp_timer_stop(tool_call_watchdog_);
+    }
+}
+
+// Call with tool_call_mutex_ held
+McpServer::ToolCall* McpServer::FindToolCall(McpToolCallId call_id) {
+    for (auto call : tool_calls_) {
+        if (call->call_id == call_id) {
+            return call;
+        }
+    }
+    return nullptr;
+}
+
+McpToolCallId McpServer::CurrentToolCall(const std::string& tool_name) {
+    auto task = xTaskGetCurrentTaskHandle();
+    std::lock_guard<std::mutex> lock(tool_call_mutex_);
+    for (auto call : tool_calls_) {
+        if (call->worker == task && call->tool->name() == tool_name) {
+            return call->call_id;
+        }
+    }
+    return 0;
+}
+
+McpToolCallId McpServer::DeferToolCall(const std::string& tool_name) {
+    auto task = xTaskGetCurrentTaskHandle();
+    std::lock_guard<std::mutex> lock(tool_call_mutex_);
+    for (auto call : tool_calls_) {
+        if (call->worker == task && call->tool->name() == tool_name) {
+            call->deferred = true;
+            return call->call_id;
+        }
+    }
+    return 0;
+}
+
+void McpServer::CompleteToolCall(McpToolCallId call_id, const ReturnValue& value) {
+    ToolReply reply = {.error = false, .text = McpTool::ToResult(value)};
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        auto call = FindToolCall(call_id);
+        if (call == nullptr || call->replied.exchange(true)) {
+            return;
+        }
+        ESP_LOGI(TAG, "tools/call: %s completed after %ld ms", call->tool->name().c_str(),
+            (long)((esp_timer_get_time() - call->enqueue_time) / 1000));
+        reply.id = call->id;
+        reply.batch = call->batch;
+        if (call->returned) {
+            FinishToolCall(call);
+        }
+    }
+    SendToolReply(reply);
+}
+
+void McpServer::FailToolCall(McpToolCallId call_id, const std::string& message) {
+    ToolReply reply = {.error = true, .text = message};
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        auto call = FindToolCall(call_id);
+        if (call == nullptr || call->replied.exchange(true)) {
+            return;
+        }
+        ESP_LOGE(TAG, "tools/call: %s failed: %s", call->tool->name().c_str(), message.c_str());
+        reply.id = call->id;
+        reply.batch = call->batch;
+        if (call->returned) {
+            FinishToolCall(call);
+        }
+    }
+    SendToolReply(reply);
+}
+
+// Call without tool_call_mutex_, the batch outlives the call until this reply finishes it
+void McpServer::SendToolReply(const ToolReply& reply) {
+    if (reply.error) {
+        ReplyError(reply.id, reply.text, reply.batch);
+    } else {
+        ReplyResult(reply.id, reply.text, reply.batch);
+    }
+    if (reply.batch != nullptr) {
+        FinishBatchRequest(reply.batch, false);
+    }
+}
+
+void McpServer::NotifyProgress(McpToolCallId call_id, int progress, int total, const std::string& message) {
+    std::string progress_token;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        auto call = FindToolCall(call_id);
+        if (call == nullptr || call->replied || call->progress_token.empty()) {
+            return;
         }
-    });
-    tool_call_thread_.detach();
-}
\ No newline at end of file
+        progress_token = call->progress_token;
+    }
+
+    cJSON* params = cJSON_CreateObject();
+    cJSON_AddNumberToObject(params, "progress", progress);
+    cJSON_AddNumberToObject(params, "total", total);
+    if (!message.empty()) {
+        cJSON_AddStringToObject(params, "message", message.c_str());
+    }
+    char* params_json = cJSON_PrintUnformatted(params);
+    // The token is spliced in as it came so a numeric token keeps its exact form
+    std::string payload = "{\"jsonrpc\":\"2.0\",\"method\":\"notifications/progress\",\"params\":{\"progressToken\":";
+    payload += progress_token;
+    payload += ",";
+    payload += params_json + 1;
+    payload += "}";
+    cJSON_free(params_json);
+    cJSON_Delete(params);
+    Application::GetInstance().SendMcpMessage(payload);
+}
+
+void McpServer::CheckToolCallDeadlines() {
+    auto now = esp_timer_get_time();
+    std::vector<ToolReply> replies;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        for (auto it = tool_calls_.begin(); it != tool_calls_.end();) {
+            auto call = *it++;
+            if (now > call->deadline && !call->replied.exchange(true)) {
+                // The tool keeps its worker until it returns, but the server gets an answer now
+                ESP_LOGE(TAG, "tools/call: %s timed out after %d ms", call->tool->name().c_str(), call->tool->timeout_ms());
+                call->tool->stats().timeouts++;
+                replies.push_back({call->id, call->batch, true, "Tool call timed out: " + call->tool->name()});
+                // A deferred call whose callback returned has nobody else to clean it up
+                if (call->returned) {
+                    FinishToolCall(call);
+                }
+            }
+        }
+    }
+    for (auto& reply : replies) {
+        SendToolReply(reply);
+    }
+}
+
+// Per MCP the cancelled request gets no reply, a running or deferred tool finishes but its result is dropped
+void McpServer::CancelToolCall(int id) {
+    std::vector<McpBatch*> batches;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        for (auto it = tool_calls_.begin(); it != tool_calls_.end();) {
+            auto call = *it++;
+            if (call->id == id && !call->replied.exchange(true)) {
+                ESP_LOGI(TAG, "tools/call: %s cancelled", call->tool->name().c_str());
+                call->tool->stats().cancels++;
+                if (call->batch != nullptr) {
+                    batches.push_back(call->batch);
+                }
+                if (call->returned) {
+                    FinishToolCall(call);
+                }
+            }
+        }
+    }
+    // A finished batch is sent as one message, never under tool_call_mutex_
+    for (auto batch : batches) {
+        FinishBatchRequest(batch, false);
+    }
+}
+
+void McpServer::PrintToolStats() {
+    std::lock_guard<std::mutex> lock(tool_call_mutex_);
+    if (requests_ > 0) {
+        ESP_LOGI(TAG, "%lu requests (%lu batches), %lu reply messages", (unsigned long)requests_, (unsigned long)batches_,
+            (unsigned long)reply_messages_);
+        requests_ = 0;
+        batches_ = 0;
+        reply_messages_ = 0;
+    }
+    for (auto tool : tools_) {
+        auto& stats = tool->stats();
+        if (stats.calls == 0 && stats.cache_hits == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "Tool %s: %lu calls, %lu cached, %lu timeouts, %lu cancels, max wait %ld ms, avg run %ld ms, max run %ld ms",
+            tool->name().c_str(), stats.calls, stats.cache_hits, stats.timeouts, stats.cancels, (long)(stats.max_wait_us / 1000),
+            (long)(stats.calls > 0 ? stats.total_run_us / stats.calls / 1000 : 0), (long)(stats.max_run_us / 1000));
+        stats = {};
+    }
+}
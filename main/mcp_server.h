@@ -8,12 +8,61 @@
 #include <variant>
 #include <optional>
 #include <stdexcept>
-#include <thread>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include <cJSON.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "mcp_scenes.h"
+#include "name_index.h"
+
+// Tool calls run on preallocated workers, one pool per stack class
+#define MCP_TOOL_STACK_SIZE_DEFAULT 6144
+#define MCP_TOOL_STACK_SIZE_LARGE 10240
+#define MCP_TOOL_WORKERS_DEFAULT 2
+#define MCP_TOOL_WORKERS_LARGE 1
+#define MCP_TOOL_QUEUE_SIZE 4
+#define MCP_TOOL_TIMEOUT_MS 10000
+// Cached results of read-only tools, and how long state changes settle before the server is notified
+#define MCP_TOOL_CACHE_TTL_MS 10000
+#define MCP_STATE_NOTIFY_DELAY_MS 1000
 
 // 添加类型别名
 using ReturnValue = std::variant<bool, int, std::string>;
+// Identifies a running tools/call for progress and deferred completion, 0 for none
+using McpToolCallId = uint32_t;
+
+enum McpToolStack {
+    kMcpToolStackDefault,
+    kMcpToolStackLarge,    // HTTP, TLS or camera work
+    kMcpToolStackCount
+};
+
+struct McpToolStats {
+    uint32_t calls = 0;
+    uint32_t timeouts = 0;
+    uint32_t cancels = 0;
+    int64_t max_wait_us = 0;
+    int64_t total_run_us = 0;
+    int64_t max_run_us = 0;
+    uint32_t cache_hits = 0;
+};
+
+// Last result of a read-only tool, valid until it expires or the device state changes
+struct McpToolCache {
+    int ttl_ms = 0;     // 0: not cached
+    std::string result;
+    int64_t expire_time = 0;
+    uint32_t generation = 0;
+};
 
 enum PropertyType {
     kPropertyTypeBoolean,
@@ -86,7 +135,7 @@ public:
         value_ = value;
     }
 
-    std::string to_json() const {
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
         
         if (type_ == kPropertyTypeBoolean) {
@@ -111,7 +160,11 @@ public:
                 cJSON_AddStringToObject(json, "default", value<std::string>().c_str());
             }
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -143,6 +196,7 @@ public:
 
     auto begin() { return properties_.begin(); }
     auto end() { return properties_.end(); }
+    bool empty() const { return properties_.empty(); }
 
     std::vector<std::string> GetRequired() const {
         std::vector<std::string> required;
@@ -154,14 +208,16 @@ public:
         return required;
     }
 
-    std::string to_json() const {
+    cJSON* to_cjson() const {
         cJSON *json = cJSON_CreateObject();
-        
         for (const auto& property : properties_) {
-            cJSON *prop_json = cJSON_Parse(property.to_json().c_str());
-            cJSON_AddItemToObject(json, property.name().c_str(), prop_json);
+            cJSON_AddItemToObject(json, property.name().c_str(), property.to_cjson());
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = to_cjson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -171,26 +227,70 @@ public:
     }
 };
 
+// A tools/call with its arguments already decoded, run later on a tool worker
+using McpToolInvocation = std::function<ReturnValue()>;
+// Decodes the call arguments, returns an empty invocation and sets error if they are invalid
+using McpToolBinder = std::function<McpToolInvocation(const cJSON* arguments, std::string& error)>;
+
 class McpTool {
 private:
     std::string name_;
+    uint32_t name_hash_ = HashName(name_);
     std::string description_;
     PropertyList properties_;
-    std::function<ReturnValue(const PropertyList&)> callback_;
+    McpToolBinder binder_;
+    std::string json_;  // serialized once, tools never change after they are added
+    McpToolStack stack_;
+    int timeout_ms_;
+    McpToolStats stats_;
+    McpToolCache cache_;
+
+    static McpToolInvocation BindProperties(const PropertyList& properties,
+        const std::function<ReturnValue(const PropertyList&)>& callback, const cJSON* arguments, std::string& error);
 
 public:
     McpTool(const std::string& name, 
             const std::string& description, 
             const PropertyList& properties, 
-            std::function<ReturnValue(const PropertyList&)> callback)
+            std::function<ReturnValue(const PropertyList&)> callback,
+            McpToolStack stack = kMcpToolStackDefault,
+            int timeout_ms = MCP_TOOL_TIMEOUT_MS)
         : name_(name), 
         description_(description), 
         properties_(properties), 
-        callback_(callback) {}
+        stack_(stack),
+        timeout_ms_(timeout_ms) {
+        binder_ = [properties, callback](const cJSON* arguments, std::string& error) {
+            return BindProperties(properties, callback, arguments, error);
+        };
+        json_ = to_json();
+    }
+
+    // properties only describe the schema, the binder decodes the arguments itself
+    McpTool(const std::string& name,
+            const std::string& description,
+            const PropertyList& properties,
+            McpToolBinder binder,
+            McpToolStack stack = kMcpToolStackDefault,
+            int timeout_ms = MCP_TOOL_TIMEOUT_MS)
+        : name_(name),
+        description_(description),
+        properties_(properties),
+        binder_(binder),
+        stack_(stack),
+        timeout_ms_(timeout_ms) {
+        json_ = to_json();
+    }
 
     inline const std::string& name() const { return name_; }
+    inline uint32_t name_hash() const { return name_hash_; }
     inline const std::string& description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
+    inline const std::string& json() const { return json_; }
+    inline McpToolStack stack() const { return stack_; }
+    inline int timeout_ms() const { return timeout_ms_; }
+    inline McpToolStats& stats() { return stats_; }
+    inline McpToolCache& cache() { return cache_; }
 
     std::string to_json() const {
         std::vector<std::string> required = properties_.GetRequired();
@@ -202,8 +302,7 @@ public:
         cJSON *input_schema = cJSON_CreateObject();
         cJSON_AddStringToObject(input_schema, "type", "object");
         
-        cJSON *properties = cJSON_Parse(properties_.to_json().c_str());
-        cJSON_AddItemToObject(input_schema, "properties", properties);
+        cJSON_AddItemToObject(input_schema, "properties", properties_.to_cjson());
         
         if (!required.empty()) {
             cJSON *required_array = cJSON_CreateArray();
@@ -223,32 +322,122 @@ public:
         return result;
     }
 
-    std::string Call(const PropertyList& properties) {
-        ReturnValue return_value = callback_(properties);
-        // 返回结果
-        cJSON* result = cJSON_CreateObject();
-        cJSON* content = cJSON_CreateArray();
-        cJSON* text = cJSON_CreateObject();
-        cJSON_AddStringToObject(text, "type", "text");
-        if (std::holds_alternative<std::string>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
-        } else if (std::holds_alternative<bool>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
-        } else if (std::holds_alternative<int>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
+    McpToolInvocation Bind(const cJSON* arguments, std::string& error) const {
+        return binder_(arguments, error);
+    }
+
+    // Run the invocation and wrap its return value as a tools/call result
+    static std::string Call(const McpToolInvocation& invocation);
+    static std::string ToResult(const ReturnValue& return_value);
+};
+
+// Typed tool arguments, the C++ parameter type of the callback selects the JSON type
+template<typename T>
+struct McpArgType;
+
+template<>
+struct McpArgType<bool> {
+    using Default = bool;
+    static constexpr PropertyType kType = kPropertyTypeBoolean;
+    static bool Decode(const cJSON* value, bool& out) {
+        if (!cJSON_IsBool(value)) {
+            return false;
+        }
+        out = cJSON_IsTrue(value);
+        return true;
+    }
+};
+
+template<>
+struct McpArgType<int> {
+    using Default = int;
+    static constexpr PropertyType kType = kPropertyTypeInteger;
+    static bool Decode(const cJSON* value, int& out) {
+        if (!cJSON_IsNumber(value)) {
+            return false;
         }
-        cJSON_AddItemToArray(content, text);
-        cJSON_AddItemToObject(result, "content", content);
-        cJSON_AddBoolToObject(result, "isError", false);
+        out = value->valueint;
+        return true;
+    }
+};
 
-        auto json_str = cJSON_PrintUnformatted(result);
-        std::string result_str(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(result);
-        return result_str;
+template<>
+struct McpArgType<std::string> {
+    using Default = const char*;
+    static constexpr PropertyType kType = kPropertyTypeString;
+    static bool Decode(const cJSON* value, std::string& out) {
+        if (!cJSON_IsString(value)) {
+            return false;
+        }
+        out = value->valuestring;
+        return true;
+    }
+};
+
+// Same forms as the Property constructors: required, with default, with range, with default and range
+template<typename T>
+struct McpArg {
+    const char* name;
+    bool has_default = false;
+    typename McpArgType<T>::Default default_value = {};
+    bool has_range = false;
+    int min_value = 0;
+    int max_value = 0;
+
+    constexpr McpArg(const char* name) : name(name) {}
+    constexpr McpArg(const char* name, typename McpArgType<T>::Default default_value)
+        : name(name), has_default(true), default_value(default_value) {}
+    constexpr McpArg(const char* name, int min_value, int max_value)
+        : name(name), has_range(true), min_value(min_value), max_value(max_value) {
+        static_assert(std::is_same_v<T, int>, "Range limits only apply to integer arguments");
+    }
+    constexpr McpArg(const char* name, int default_value, int min_value, int max_value)
+        : name(name), has_default(true), default_value(default_value), has_range(true), min_value(min_value), max_value(max_value) {
+        static_assert(std::is_same_v<T, int>, "Range limits only apply to integer arguments");
+    }
+
+    Property ToProperty() const {
+        if constexpr (std::is_same_v<T, int>) {
+            if (has_range) {
+                return has_default ? Property(name, kPropertyTypeInteger, default_value, min_value, max_value)
+                                   : Property(name, kPropertyTypeInteger, min_value, max_value);
+            }
+        }
+        if (has_default) {
+            return Property(name, McpArgType<T>::kType, T(default_value));
+        }
+        return Property(name, McpArgType<T>::kType);
+    }
+
+    bool Decode(const cJSON* arguments, T& value, std::string& error) const {
+        auto item = cJSON_IsObject(arguments) ? cJSON_GetObjectItem(arguments, name) : nullptr;
+        if (!McpArgType<T>::Decode(item, value)) {
+            if (!has_default) {
+                error = std::string("Missing valid argument: ") + name;
+                return false;
+            }
+            value = T(default_value);
+            return true;
+        }
+        if constexpr (std::is_same_v<T, int>) {
+            if (has_range && value < min_value) {
+                error = "Value is below minimum allowed: " + std::to_string(min_value);
+                return false;
+            }
+            if (has_range && value > max_value) {
+                error = "Value exceeds maximum allowed: " + std::to_string(max_value);
+                return false;
+            }
+        }
+        return true;
     }
 };
 
+template<typename... T>
+inline std::tuple<McpArg<T>...> McpArgs(const McpArg<T>&... args) {
+    return std::tuple<McpArg<T>...>(args...);
+}
+
 class McpServer {
 public:
     static McpServer& GetInstance() {
@@ -258,9 +447,47 @@ public:
 
     void AddCommonTools();
     void AddTool(McpTool* tool);
-    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+        McpToolStack stack = kMcpToolStackDefault, int timeout_ms = MCP_TOOL_TIMEOUT_MS);
+    // Typed tool: the schema comes from the McpArg list and the arguments are decoded straight into the callback parameters
+    // e.g. AddTool(name, description, McpArgs(McpArg<int>("volume", 0, 100)), [](int volume) -> ReturnValue { ... })
+    template<typename... T, typename Callback>
+    void AddTool(const std::string& name, const std::string& description, const std::tuple<McpArg<T>...>& args, Callback callback,
+        McpToolStack stack = kMcpToolStackDefault, int timeout_ms = MCP_TOOL_TIMEOUT_MS) {
+        static_assert(std::is_invocable_r_v<ReturnValue, Callback&, T&...>, "The callback must take the arguments in order");
+        PropertyList properties;
+        std::apply([&properties](const auto&... arg) { (properties.AddProperty(arg.ToProperty()), ...); }, args);
+        McpToolBinder binder = [args, callback](const cJSON* arguments, std::string& error) -> McpToolInvocation {
+            std::tuple<T...> values;
+            if (!DecodeArgs(args, arguments, values, error, std::index_sequence_for<T...>())) {
+                return nullptr;
+            }
+            return [callback, values = std::move(values)]() mutable -> ReturnValue {
+                return std::apply(callback, values);
+            };
+        };
+        AddTool(new McpTool(name, description, properties, binder, stack, timeout_ms));
+    }
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
+    McpTool* FindTool(const NameKey& name);
+    // Only for read-only tools without arguments
+    void SetToolCache(const std::string& name, int ttl_ms = MCP_TOOL_CACHE_TTL_MS);
+    // Called on volume, brightness, theme and network changes: cached results become stale
+    // and the server is notified once the changes settle, so it does not need to poll
+    void NotifyStateChanged();
+
+    // Inside the callback of tool_name: the call being run, 0 if the tool was not called by the server (e.g. in a scene)
+    McpToolCallId CurrentToolCall(const std::string& tool_name);
+    // Inside the callback of tool_name: the return value is ignored and the call is answered
+    // later by CompleteToolCall or FailToolCall from any task, e.g. when a motor stops
+    McpToolCallId DeferToolCall(const std::string& tool_name);
+    void CompleteToolCall(McpToolCallId call_id, const ReturnValue& value);
+    void FailToolCall(McpToolCallId call_id, const std::string& message);
+    // notifications/progress, only sent if the server asked for it with a progressToken
+    void NotifyProgress(McpToolCallId call_id, int progress, int total, const std::string& message = "");
+
+    void PrintToolStats();
 
 private:
     McpServer();
@@ -268,14 +495,94 @@ private:
 
     void ParseCapabilities(const cJSON* capabilities);
 
-    void ReplyResult(int id, const std::string& result);
-    void ReplyError(int id, const std::string& message);
+    template<typename... T, size_t... I>
+    static bool DecodeArgs(const std::tuple<McpArg<T>...>& args, const cJSON* arguments, std::tuple<T...>& values,
+        std::string& error, std::index_sequence<I...>) {
+        return (std::get<I>(args).Decode(arguments, std::get<I>(values), error) && ...);
+    }
 
-    void GetToolsList(int id, const std::string& cursor);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size);
+    // Requests of one JSON-RPC batch, replied as one array when the last of them is answered
+    struct McpBatch {
+        int size = 0;
+        int pending_calls = 0;  // tool calls still running
+        bool parsed = false;
+        int64_t start_time = 0;
+        std::vector<std::string> replies;
+    };
+    std::mutex batch_mutex_;
+    std::atomic<uint32_t> requests_{0};
+    std::atomic<uint32_t> batches_{0};
+    std::atomic<uint32_t> reply_messages_{0};
+
+    void ParseBatch(const cJSON* json);
+    void ParseRequest(const cJSON* json, McpBatch* batch);
+    void ReplyResult(int id, const std::string& result, McpBatch* batch = nullptr);
+    void ReplyError(int id, const std::string& message, McpBatch* batch = nullptr);
+    void SendReply(std::string&& payload, McpBatch* batch);
+    void FinishBatchRequest(McpBatch* batch, bool parsed);
+
+    void GetToolsList(int id, const std::string& cursor, McpBatch* batch);
+    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size,
+        const std::string& progress_token, McpBatch* batch);
+    void CancelToolCall(int id);
 
     std::vector<McpTool*> tools_;
-    std::thread tool_call_thread_;
+    NameIndex tools_index_;     // by name, ids are positions in tools_
+    McpScenes scenes_;
+    std::atomic<uint32_t> state_generation_{0};
+    std::atomic<bool> initialized_{false};
+    esp_timer_handle_t state_notify_timer_ = nullptr;
+
+    void SendStateChanged();
+
+    // A queued or running tools/call, replied exactly once by the worker, a deferred completion, the watchdog or a cancel.
+    // Deleted once it is replied and its callback returned
+    struct ToolCall {
+        int id;
+        McpToolCallId call_id = 0;
+        McpTool* tool;
+        McpToolInvocation invocation;
+        int64_t enqueue_time;
+        int64_t deadline;
+        std::atomic<bool> replied{false};
+        McpBatch* batch = nullptr;
+        std::string progress_token;     // JSON string or number, empty if no progress was asked for
+        TaskHandle_t worker = nullptr;  // set while the callback runs
+        bool deferred = false;
+        bool returned = false;
+    };
+    // A reply decided under tool_call_mutex_ and sent once it is released
+    struct ToolReply {
+        int id = 0;
+        McpBatch* batch = nullptr;
+        bool error = false;
+        std::string text;
+    };
+    std::mutex tool_call_mutex_;
+    std::list<ToolCall*> tool_calls_;
+    McpToolCallId last_call_id_ = 0;
+    QueueHandle_t tool_call_queues_[kMcpToolStackCount] = {};
+    esp_timer_handle_t tool_call_watchdog_ = nullptr;
+    bool tool_call_watchdog_running_ = false;
+
+    bool StartToolWorkers();
+    void SendToolReply(const ToolReply& reply);
+    void StopToolQueues();
+    void ToolWorkerLoop(McpToolStack stack);
+    void RunToolCall(ToolCall* call);
+    void CheckToolCallDeadlines();
+    ToolCall* FindToolCall(McpToolCallId call_id);
+    void FinishToolCall(ToolCall* call);
+
+    // tools/list replies, built once after the tools change
+    struct ToolsListPage {
+        std::string cursor;     // name of the first tool in the page
+        std::string json;       // empty if the tool alone exceeds the payload limit
+    };
+    std::vector<ToolsListPage> tools_list_pages_;
+    bool tools_list_dirty_ = true;
+
+    void BuildToolsListPages();
 };
 
 #endif // MCP_SERVER_H
@@ -0,0 +1,98 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Hashes 4 bytes per step, constexpr so a name known at compile time costs nothing
+constexpr uint32_t HashName(std::string_view name) {
+    uint32_t hash = (uint32_t)name.size() * 0x9E3779B1u;
+    size_t i = 0;
+    for (; i + 4 <= name.size(); i += 4) {
+        uint32_t word = (uint32_t)(uint8_t)name[i] | (uint32_t)(uint8_t)name[i + 1] << 8 |
+            (uint32_t)(uint8_t)name[i + 2] << 16 | (uint32_t)(uint8_t)name[i + 3] << 24;
+        hash = (hash ^ word) * 0x85EBCA6Bu;
+        hash ^= hash >> 13;
+    }
+    for (; i < name.size(); i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 0x85EBCA6Bu;
+    }
+    return hash ^ (hash >> 16);
+}
+
+// A name to look up with its hash, computed once per message and passed down.
+// It only views the name, do not keep it beyond the call.
+struct NameKey {
+    std::string_view name;
+    uint32_t hash;
+
+    constexpr NameKey(const char* name) : name(name), hash(HashName(name)) {}
+    constexpr NameKey(std::string_view name, uint32_t hash) : name(name), hash(hash) {}
+    NameKey(const std::string& name) : name(name), hash(HashName(name)) {}
+};
+
+// Open addressing table from name hash to the position of the entry in the owner's vector,
+// which is the stable id of the entry. Only pays off for registries of a few dozen names,
+// a list of a handful of names is faster to scan.
+class NameIndex {
+public:
+    void Add(uint32_t hash, size_t id) {
+        if ((count_ + 1) * 2 > slots_.size()) {
+            Grow();
+        }
+        Insert(hash, id);
+        count_++;
+    }
+
+    void Clear() {
+        slots_.clear();
+        count_ = 0;
+    }
+
+    // Returns the id, or -1. Names are compared only on a hash hit, name_of(id) returns the entry's name
+    template<typename NameOf>
+    int Find(const NameKey& key, NameOf name_of) const {
+        if (slots_.empty()) {
+            return -1;
+        }
+        size_t mask = slots_.size() - 1;
+        for (size_t i = key.hash & mask; slots_[i].id != 0; i = (i + 1) & mask) {
+            if (slots_[i].hash == key.hash && name_of(slots_[i].id - 1) == key.name) {
+                return (int)slots_[i].id - 1;
+            }
+        }
+        return -1;
+    }
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t id;    // id + 1, 0 for an empty slot
+    };
+    std::vector<Slot> slots_;
+    size_t count_ = 0;
+
+    void Insert(uint32_t hash, size_t id) {
+        size_t mask = slots_.size() - 1;
+        size_t i = hash & mask;
+        while (slots_[i].id != 0) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = {hash, (uint32_t)id + 1};
+    }
+
+    void Grow() {
+        auto old_slots = std::move(slots_);
+        slots_.assign(old_slots.empty() ? 16 : old_slots.size() * 2, Slot{0, 0});
+        for (auto& slot : old_slots) {
+            if (slot.id != 0) {
+                Insert(slot.hash, slot.id - 1);
+            }
+        }
+    }
+};
+
+#endif // NAME_INDEX_H
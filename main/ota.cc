@@ -20,7 +20,19 @@
 #include <algorithm>
 
 #define TAG "Ota"
+// nvs_set_str 的上限（含结尾的 0），超出会返回错误
+#define NVS_MAX_STRING_SIZE 4000
 
+// Server supplied JSON goes to NVS only if it fits, an oversized config must not abort the boot
+static void StoreConfigJson(Settings& settings, const char* key, const char* json) {
+    if (strlen(json) + 1 > NVS_MAX_STRING_SIZE) {
+        ESP_LOGW(TAG, "Config %s is %u bytes, over the NVS limit of %d, ignored", key, (unsigned)strlen(json), NVS_MAX_STRING_SIZE);
+        return;
+    }
+    if (settings.GetString(key) != json) {
+        settings.SetString(key, json);
+    }
+}
 
 Ota::Ota() {
 #ifdef ESP_EFUSE_BLOCK_USR_DATA
@@ -172,6 +184,30 @@ bool Ota::CheckVersion() {
         ESP_LOGI(TAG, "No websocket section found!");
     }
 
+    // Custom display themes, loaded by the display at the next boot
+    cJSON *display = cJSON_GetObjectItem(root, "display");
+    if (cJSON_IsObject(display)) {
+        cJSON *themes = cJSON_GetObjectItem(display, "themes");
+        if (cJSON_IsObject(themes)) {
+            Settings settings("display", true);
+            char *themes_json = cJSON_PrintUnformatted(themes);
+            StoreConfigJson(settings, "themes", themes_json);
+            cJSON_free(themes_json);
+        }
+    }
+
+    // Local scenes for the self.scene.run tool, loaded at the next boot
+    cJSON *mcp = cJSON_GetObjectItem(root, "mcp");
+    if (cJSON_IsObject(mcp)) {
+        cJSON *scenes = cJSON_GetObjectItem(mcp, "scenes");
+        if (cJSON_IsObject(scenes)) {
+            Settings settings("mcp", true);
+            char *scenes_json = cJSON_PrintUnformatted(scenes);
+            StoreConfigJson(settings, "scenes", scenes_json);
+            cJSON_free(scenes_json);
+        }
+    }
+
     has_server_time_ = false;
     cJSON *server_time = cJSON_GetObjectItem(root, "server_time");
     if (cJSON_IsObject(server_time)) {
@@ -31,6 +31,72 @@ void Protocol::SetError(const std::string& message) {
     }
 }
 
+void Protocol::ParseServerFeatures(const cJSON* root) {
+    server_dtx_ = false;
+    server_iot_batch_ = false;
+
+    auto features = cJSON_GetObjectItem(root, "features");
+    if (!cJSON_IsObject(features)) {
+        return;
+    }
+    auto dtx = cJSON_GetObjectItem(features, "dtx");
+    server_dtx_ = cJSON_IsTrue(dtx);
+    auto iot_batch = cJSON_GetObjectItem(features, "iot_batch");
+    server_iot_batch_ = cJSON_IsTrue(iot_batch);
+    ESP_LOGI(TAG, "Server features: dtx=%d iot_batch=%d", server_dtx_, server_iot_batch_);
+}
+
+static bool IsValidFrameDuration(int frame_duration) {
+    return frame_duration == 20 || frame_duration == 40 || frame_duration == 60;
+}
+
+// Opus packets carry 10 to 120 ms, the downlink duration only sizes the decode queue
+static bool IsValidServerFrameDuration(int frame_duration) {
+    return frame_duration == 10 || (frame_duration >= 20 && frame_duration <= 120 && frame_duration % 20 == 0);
+}
+
+void Protocol::SetPreferredFrameDuration(int frame_duration) {
+    if (!IsValidFrameDuration(frame_duration)) {
+        ESP_LOGW(TAG, "Invalid frame duration %d, using 60ms", frame_duration);
+        frame_duration = 60;
+    }
+    preferred_frame_duration_ = frame_duration;
+    frame_duration_ = frame_duration;
+}
+
+void Protocol::ParseServerAudioParams(const cJSON* root) {
+    frame_duration_ = preferred_frame_duration_;
+
+    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    if (!cJSON_IsObject(audio_params)) {
+        return;
+    }
+    auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
+    if (cJSON_IsNumber(sample_rate)) {
+        server_sample_rate_ = sample_rate->valueint;
+    }
+    auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+    if (cJSON_IsNumber(frame_duration)) {
+        if (IsValidServerFrameDuration(frame_duration->valueint)) {
+            server_frame_duration_ = frame_duration->valueint;
+        } else {
+            ESP_LOGW(TAG, "Unsupported server frame duration: %d, using 60ms", frame_duration->valueint);
+            server_frame_duration_ = 60;
+        }
+    }
+    // Servers that only accept certain uplink frame durations answer with their choice
+    auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+    if (cJSON_IsNumber(uplink_frame_duration)) {
+        if (IsValidFrameDuration(uplink_frame_duration->valueint)) {
+            frame_duration_ = uplink_frame_duration->valueint;
+        } else {
+            ESP_LOGW(TAG, "Unsupported uplink frame duration: %d", uplink_frame_duration->valueint);
+        }
+    }
+    ESP_LOGI(TAG, "Audio params: downlink %d Hz / %d ms, uplink %d ms",
+        server_sample_rate_, server_frame_duration_, frame_duration_);
+}
+
 void Protocol::SendAbortSpeaking(AbortReason reason) {
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
     if (reason == kAbortReasonWakeWordDetected) {
@@ -65,49 +131,38 @@ void Protocol::SendStopListening() {
     SendText(message);
 }
 
-void Protocol::SendIotDescriptors(const std::string& descriptors) {
-    cJSON* root = cJSON_Parse(descriptors.c_str());
-    if (root == nullptr) {
-        ESP_LOGE(TAG, "Failed to parse IoT descriptors: %s", descriptors.c_str());
-        return;
-    }
-
-    if (!cJSON_IsArray(root)) {
-        ESP_LOGE(TAG, "IoT descriptors should be an array");
-        cJSON_Delete(root);
+// The descriptors are already serialized, only the envelope with the session id is added here
+void Protocol::SendIotDescriptors(const std::vector<std::string>& descriptors) {
+    if (descriptors.empty()) {
         return;
     }
-
-    int arraySize = cJSON_GetArraySize(root);
-    for (int i = 0; i < arraySize; ++i) {
-        cJSON* descriptor = cJSON_GetArrayItem(root, i);
-        if (descriptor == nullptr) {
-            ESP_LOGE(TAG, "Failed to get IoT descriptor at index %d", i);
-            continue;
+    const std::string header = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"descriptors\":[";
+    if (server_iot_batch_) {
+        size_t size = header.size() + 2;
+        for (auto& descriptor : descriptors) {
+            size += descriptor.size() + 1;
         }
-
-        cJSON* messageRoot = cJSON_CreateObject();
-        cJSON_AddStringToObject(messageRoot, "session_id", session_id_.c_str());
-        cJSON_AddStringToObject(messageRoot, "type", "iot");
-        cJSON_AddBoolToObject(messageRoot, "update", true);
-
-        cJSON* descriptorArray = cJSON_CreateArray();
-        cJSON_AddItemToArray(descriptorArray, cJSON_Duplicate(descriptor, 1));
-        cJSON_AddItemToObject(messageRoot, "descriptors", descriptorArray);
-
-        char* message = cJSON_PrintUnformatted(messageRoot);
-        if (message == nullptr) {
-            ESP_LOGE(TAG, "Failed to print JSON message for IoT descriptor at index %d", i);
-            cJSON_Delete(messageRoot);
-            continue;
+        std::string message;
+        message.reserve(size);
+        message += header;
+        for (auto& descriptor : descriptors) {
+            message += descriptor;
+            message += ',';
         }
-
-        SendText(std::string(message));
-        cJSON_free(message);
-        cJSON_Delete(messageRoot);
+        message.back() = ']';
+        message += '}';
+        SendText(message);
+        return;
     }
 
-    cJSON_Delete(root);
+    std::string message;
+    for (auto& descriptor : descriptors) {
+        message.reserve(header.size() + descriptor.size() + 2);
+        message = header;
+        message += descriptor;
+        message += "]}";
+        SendText(message);
+    }
 }
 
 void Protocol::SendIotStates(const std::string& states) {
@@ -54,6 +54,16 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline bool server_dtx() const {
+        return server_dtx_;
+    }
+    // Uplink frame duration agreed in the last hello
+    inline int frame_duration() const {
+        return frame_duration_;
+    }
+
+    // Uplink frame duration proposed in the hello message, 20/40/60 ms
+    void SetPreferredFrameDuration(int frame_duration);
 
     void OnIncomingAudio(std::function<void(AudioStreamPacket&& packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
@@ -70,7 +80,8 @@ public:
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
-    virtual void SendIotDescriptors(const std::string& descriptors);
+    // One message per descriptor, or a single message if the server supports iot_batch
+    virtual void SendIotDescriptors(const std::vector<std::string>& descriptors);
     virtual void SendIotStates(const std::string& states);
     virtual void SendMcpMessage(const std::string& message);
 
@@ -83,11 +94,17 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    bool server_dtx_ = false;
+    bool server_iot_batch_ = false;
+    int preferred_frame_duration_ = 60;
+    int frame_duration_ = 60;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
+    virtual void ParseServerFeatures(const cJSON* root);
+    virtual void ParseServerAudioParams(const cJSON* root);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };